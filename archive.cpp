@@ -0,0 +1,442 @@
+/**
+    archive.cpp
+
+    Append-only archive of the samples of swipes.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#include "archive.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+// Platform-dependent truncation
+#if defined( __WINDOWS_ASIO__ ) || defined( __WINDOWS_DS__ )
+  #include <io.h>
+#else // Unix variants
+  #include <unistd.h>
+#endif
+
+
+// Sizes of the fixed parts of the file (in bytes)
+#define HEADER_SIZE 8
+#define SEGMENT_HEADER_SIZE 26
+#define INDEX_ENTRY_SIZE 17
+#define TRAILER_SIZE 24
+
+
+// Differences of the samples, zig-zag mapped, as varints
+static void
+encode_samples(const SampleSegment& samples, std::string& out)
+{
+    int previous = 0;
+
+    for(size_t i = 0; i < samples.part_count(); i++)
+    {
+        const SampleSpan& part = samples.part(i);
+
+        for(size_t j = 0; j < part.size(); j++)
+        {
+            int delta = part[j] - previous;
+            previous = part[j];
+
+            uint32_t value = ((uint32_t) delta << 1) ^ (uint32_t) (delta >> 31);
+            while(value >= 0x80)
+            {
+                out.push_back((char) (value | 0x80));
+                value >>= 7;
+            }
+            out.push_back((char) value);
+        }
+    }
+}
+
+
+ArchiveWriter::ArchiveWriter(void) :
+        file(NULL), end(0), failed(false), stopping(false)
+{
+}
+
+ArchiveWriter::~ArchiveWriter(void)
+{
+    close();
+}
+
+bool
+ArchiveWriter::fail(const std::string& message)
+{
+    error = message;
+
+    if(file != NULL)
+    {
+        fclose(file);
+        file = NULL;
+    }
+
+    return false;
+}
+
+bool
+ArchiveWriter::open(const char* file_name)
+{
+    close();
+    error.clear();
+    index.clear();
+
+    // A new archive
+    FILE* existing = fopen(file_name, "rb");
+    if(existing == NULL)
+    {
+        file = fopen(file_name, "wb");
+        if(file == NULL)
+            return fail(std::string("Could not create ") + file_name);
+
+        if(fwrite(ARCHIVE_MAGIC, 1, HEADER_SIZE, file) != HEADER_SIZE)
+            return fail(std::string("Could not write ") + file_name);
+
+        end = HEADER_SIZE;
+        thread = std::thread(&ArchiveWriter::run, this);
+        return true;
+    }
+    fclose(existing);
+
+    // Swipes of an existing archive are kept, its index is rewritten
+    {
+        ArchiveReader reader;
+        if(! reader.open(file_name))
+            return fail(reader.get_error());
+
+        for(size_t i = 0; i < reader.size(); i++)
+        {
+            const ArchiveEntry& entry = reader.entry(i);
+            IndexEntry item = { entry.offset, entry.time, entry.outcome };
+            index.push_back(item);
+        }
+
+        end = reader.get_data_end();
+    }
+
+    file = fopen(file_name, "r+b");
+    if(file == NULL)
+        return fail(std::string("Could not open ") + file_name);
+
+    // Drop the old index, or the rest of a swipe cut off by a crash
+    fflush(file);
+#if defined( __WINDOWS_ASIO__ ) || defined( __WINDOWS_DS__ )
+    if(_chsize_s(_fileno(file), (long long) end) != 0)
+#else
+    if(ftruncate(fileno(file), (off_t) end) != 0)
+#endif
+        return fail(std::string("Could not truncate ") + file_name);
+
+    if(fseek(file, 0, SEEK_END) != 0)
+        return fail(std::string("Could not seek in ") + file_name);
+
+    thread = std::thread(&ArchiveWriter::run, this);
+    return true;
+}
+
+bool
+ArchiveWriter::close(void)
+{
+    // Let the writer finish the pending swipes
+    if(thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+
+        wake.notify_one();
+        thread.join();
+    }
+
+    stopping = false;
+
+    if(file == NULL)
+        return error.empty();
+
+    // Without an index the swipes written are found by scanning
+    if(failed)
+    {
+        fclose(file);
+        file = NULL;
+        failed = false;
+        return false;
+    }
+
+    // Index and trailer
+    std::string buffer;
+    for(size_t i = 0; i < index.size(); i++)
+    {
+        append_le(buffer, index[i].offset, 8);
+        append_le(buffer, index[i].time, 8);
+        append_le(buffer, index[i].outcome, 1);
+    }
+    append_le(buffer, end, 8);
+    append_le(buffer, index.size(), 8);
+    buffer.append(ARCHIVE_INDEX_MAGIC);
+
+    bool written = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+    written = fclose(file) == 0 && written;
+    file = NULL;
+
+    if(! written)
+        error = "Could not write the index of the archive";
+
+    return written;
+}
+
+bool
+ArchiveWriter::append(const SampleSegment& samples, unsigned int sample_rate,
+                      ArchiveOutcome outcome, const std::string& source)
+{
+    uint64_t time = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    size_t source_length = source.size() < 0xFF ? source.size() : 0xFF;
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // A stalled disk holds up the decoders only when much is pending
+    room.wait(lock, [this]() { return pending.size() < ARCHIVE_LIMIT || failed; });
+
+    if(file == NULL || failed)
+        return false;
+
+    // Header, with the size of the coded samples filled in last
+    const bool first = pending.empty();
+    const size_t start = pending.size();
+    pending.append(ARCHIVE_SEGMENT_MAGIC);
+    append_le(pending, 0, 4);
+    append_le(pending, samples.size(), 4);
+    append_le(pending, sample_rate, 4);
+    append_le(pending, time, 8);
+    append_le(pending, outcome, 1);
+    append_le(pending, source_length, 1);
+    pending.append(source, 0, source_length);
+
+    const size_t header_size = pending.size() - start;
+    encode_samples(samples, pending);
+
+    uint64_t coded_size = pending.size() - start - header_size;
+    for(unsigned int i = 0; i < 4; i++)
+    {
+        pending[start + 4 + i] = (char) ((coded_size >> (8 * i)) & 0xFF);
+    }
+
+    IndexEntry item = { end, time, outcome };
+    index.push_back(item);
+    end += pending.size() - start;
+
+    lock.unlock();
+
+    // Writer waits for the first swipe, and takes all pending by then
+    if(first)
+    {
+        wake.notify_one();
+    }
+
+    return true;
+}
+
+void
+ArchiveWriter::run(void)
+{
+    std::string batch;
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while(true)
+    {
+        // Sleep until there is something to write
+        wake.wait(lock, [this]() { return stopping || ! pending.empty(); });
+
+        if(pending.empty())
+            break;
+
+        // Write without blocking the decoders
+        batch.swap(pending);
+        lock.unlock();
+        room.notify_all();
+
+        // Complete swipes survive a crash
+        bool written = fwrite(batch.data(), 1, batch.size(), file) == batch.size() &&
+                       fflush(file) == 0;
+        batch.clear();
+
+        lock.lock();
+
+        // Reported once; swipes appended meanwhile are dropped too
+        if(! written)
+        {
+            failed = true;
+            error = "Could not append to the archive";
+            pending.clear();
+            room.notify_all();
+
+            std::cerr << "Error: " << error << "!" << std::endl;
+            break;
+        }
+    }
+}
+
+
+ArchiveReader::ArchiveReader(void) :
+        scanned(false), data_end(0)
+{
+}
+
+ArchiveReader::~ArchiveReader(void)
+{
+    close();
+}
+
+bool
+ArchiveReader::open(const char* file_name)
+{
+    close();
+    error.clear();
+
+    if(! file.open(file_name))
+        return fail(file.get_error());
+
+    if(file.size() < HEADER_SIZE || memcmp(file.data(), ARCHIVE_MAGIC, HEADER_SIZE) != 0)
+        return fail(std::string(file_name) + " is not a swipe archive");
+
+    if(! read_index())
+        scan();
+
+    return true;
+}
+
+void
+ArchiveReader::close(void)
+{
+    file.close();
+    entries.clear();
+    scanned = false;
+    data_end = 0;
+}
+
+bool
+ArchiveReader::read_segment(uint64_t offset, ArchiveEntry& entry) const
+{
+    const unsigned char* data = file.data();
+
+    if(offset < HEADER_SIZE || offset + SEGMENT_HEADER_SIZE > file.size() ||
+       memcmp(data + offset, ARCHIVE_SEGMENT_MAGIC, 4) != 0)
+        return false;
+
+    const unsigned char* header = data + offset;
+    size_t source_length = header[25];
+    uint64_t coded_start = offset + SEGMENT_HEADER_SIZE + source_length;
+
+    entry.offset = offset;
+    entry.coded_size = read_le(header + 4, 4);
+    entry.sample_count = read_le(header + 8, 4);
+    entry.sample_rate = read_le(header + 12, 4);
+    entry.time = read_le(header + 16, 8);
+    entry.outcome = (ArchiveOutcome) header[24];
+
+    // Swipe cut off
+    if(coded_start + entry.coded_size > file.size())
+        return false;
+
+    entry.source.assign((const char*) header + SEGMENT_HEADER_SIZE, source_length);
+    entry.coded = data + coded_start;
+
+    return true;
+}
+
+bool
+ArchiveReader::read_index(void)
+{
+    const unsigned char* data = file.data();
+
+    if(file.size() < HEADER_SIZE + TRAILER_SIZE)
+        return false;
+
+    const unsigned char* trailer = data + file.size() - TRAILER_SIZE;
+    if(memcmp(trailer + 16, ARCHIVE_INDEX_MAGIC, 8) != 0)
+        return false;
+
+    uint64_t index_offset = read_le(trailer, 8);
+    uint64_t count = read_le(trailer + 8, 8);
+
+    if(index_offset < HEADER_SIZE ||
+       count > (file.size() - TRAILER_SIZE) / INDEX_ENTRY_SIZE ||
+       index_offset + count * INDEX_ENTRY_SIZE + TRAILER_SIZE != file.size())
+        return false;
+
+    // Swipes as listed, each checked against its header
+    entries.resize(count);
+    for(uint64_t i = 0; i < count; i++)
+    {
+        uint64_t offset = read_le(data + index_offset + i * INDEX_ENTRY_SIZE, 8);
+
+        if(! read_segment(offset, entries[i]) ||
+           entries[i].coded + entries[i].coded_size > data + index_offset)
+        {
+            entries.clear();
+            return false;
+        }
+    }
+
+    data_end = index_offset;
+    return true;
+}
+
+void
+ArchiveReader::scan(void)
+{
+    entries.clear();
+    scanned = true;
+
+    // Complete swipes one after another
+    uint64_t offset = HEADER_SIZE;
+    ArchiveEntry entry;
+    while(read_segment(offset, entry))
+    {
+        entries.push_back(entry);
+        offset = (entry.coded - file.data()) + entry.coded_size;
+    }
+
+    data_end = offset;
+}
+
+bool
+ArchiveReader::samples(size_t index, std::vector<sample_t>& output) const
+{
+    const ArchiveEntry& entry = entries[index];
+    const unsigned char* p = entry.coded;
+    const unsigned char* coded_end = entry.coded + entry.coded_size;
+
+    output.resize(entry.sample_count);
+
+    int previous = 0;
+    for(size_t i = 0; i < entry.sample_count; i++)
+    {
+        // Varint of up to three bytes for 17 bits
+        uint32_t value = 0;
+        unsigned int shift = 0;
+        do
+        {
+            if(p == coded_end || shift > 14)
+                return false;
+
+            value |= (uint32_t) (*p & 0x7F) << shift;
+            shift += 7;
+        }
+        while(*p++ & 0x80);
+
+        int delta = (int) (value >> 1) ^ -(int) (value & 1);
+        previous += delta;
+        output[i] = (sample_t) previous;
+    }
+
+    return p == coded_end;
+}
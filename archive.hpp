@@ -0,0 +1,161 @@
+/**
+    archive.hpp
+
+    Append-only archive of the samples of swipes.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#ifndef ARCHIVE_HPP
+#define ARCHIVE_HPP
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <inttypes.h>
+
+#include "decoder.hpp"
+#include "fileio.hpp"
+#include "samples.hpp"
+
+
+// Beginning of an archive, of a swipe in it, and of its index
+#define ARCHIVE_MAGIC "MCUSWIPE"
+#define ARCHIVE_SEGMENT_MAGIC "SWIP"
+#define ARCHIVE_INDEX_MAGIC "MCUINDEX"
+
+// Coded swipes pending before appending waits for the writer (in bytes)
+#define ARCHIVE_LIMIT (16 * 1024 * 1024)
+
+
+/**
+    Swipe stored in an archive.
+*/
+struct ArchiveEntry
+{
+    uint64_t offset;        // Of the swipe in the file
+    const unsigned char* coded; // Coded samples, mapped
+    size_t coded_size;      // In bytes
+    size_t sample_count;
+    unsigned int sample_rate;
+    uint64_t time;          // Microseconds since the epoch
+    ArchiveOutcome outcome;
+    std::string source;     // Reader or recording the swipe came from
+};
+
+
+/**
+    Writer appending swipes to an archive, from any thread.
+
+    An archive starts with ARCHIVE_MAGIC, followed by the swipes. Every
+    swipe consists of little endian fields: ARCHIVE_SEGMENT_MAGIC, size
+    of the coded samples (u32), sample count (u32), sample rate (u32),
+    time in microseconds since the epoch (u64), outcome (u8), length of
+    the source (u8), the source, and the coded samples. Samples are
+    coded as differences to the previous one, zig-zag mapped to
+    unsigned values and written as varints of 7 bits per byte, lowest
+    first; silence takes a byte per sample, noise mostly two.
+
+    When closed, an index follows: offset (u64), time (u64) and outcome
+    (u8) of every swipe, the offset of the index (u64), the number of
+    swipes (u64) and ARCHIVE_INDEX_MAGIC. Appending to an archive
+    replaces its index. Without an index, e.g. after a crash, the
+    complete swipes are found by scanning.
+
+    Swipes are coded by the appending thread and written by a thread
+    of the writer, so that the decoders do not wait for the disk
+    unless ARCHIVE_LIMIT bytes are pending. The first write error is
+    reported on stderr; after it, nothing more is appended.
+*/
+class ArchiveWriter : public SwipeArchive
+{
+public:
+    ArchiveWriter(void);
+    virtual ~ArchiveWriter(void);
+
+    ArchiveWriter(const ArchiveWriter&) = delete;
+    ArchiveWriter& operator=(const ArchiveWriter&) = delete;
+
+    // Create an archive, or open an existing one to append to
+    bool open(const char* file_name);
+    // Write the index and close the archive; false on errors
+    bool close(void);
+    const std::string& get_error(void) const { return error; }
+
+    // Append the samples of a swipe
+    virtual bool append(const SampleSegment& samples, unsigned int sample_rate,
+                        ArchiveOutcome outcome, const std::string& source);
+
+private:
+    struct IndexEntry
+    {
+        uint64_t offset;
+        uint64_t time;
+        ArchiveOutcome outcome;
+    };
+
+    bool fail(const std::string& message);
+    void run(void);
+
+    FILE* file;
+    uint64_t end;       // Of the last swipe appended
+    std::vector<IndexEntry> index;
+
+    std::mutex mutex;
+    std::condition_variable wake;   // of the writer
+    std::condition_variable room;   // for appending
+    std::string pending;    // Swipes not yet taken by the writer
+    bool failed;
+    bool stopping;
+    std::thread thread;
+    std::string error;
+};
+
+
+/**
+    Archive mapped into memory, for replaying its swipes.
+*/
+class ArchiveReader
+{
+public:
+    ArchiveReader(void);
+    ~ArchiveReader(void);
+
+    ArchiveReader(const ArchiveReader&) = delete;
+    ArchiveReader& operator=(const ArchiveReader&) = delete;
+
+    bool open(const char* file_name);
+    void close(void);
+    const std::string& get_error(void) const { return error; }
+
+    size_t size(void) const { return entries.size(); }
+    const ArchiveEntry& entry(size_t index) const { return entries[index]; }
+    // Index was missing or broken, so the swipes were scanned
+    bool is_scanned(void) const { return scanned; }
+    // End of the last complete swipe
+    uint64_t get_data_end(void) const { return data_end; }
+
+    // Decode the samples of a swipe; false if they are corrupt
+    bool samples(size_t index, std::vector<sample_t>& output) const;
+
+private:
+    bool read_segment(uint64_t offset, ArchiveEntry& entry) const;
+    bool read_index(void);
+    void scan(void);
+    bool fail(const std::string& message) { error = message; close(); return false; }
+
+    MappedFile file;
+    std::vector<ArchiveEntry> entries;
+    bool scanned;
+    uint64_t data_end;
+    std::string error;
+};
+
+
+#endif /* ARCHIVE_HPP */
@@ -0,0 +1,568 @@
+/**
+    benchmark.cpp
+
+    Benchmarks of the decoder on synthetic swipes.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#include "biphase.hpp"
+#include "decoder.hpp"
+#include "encodings.hpp"
+#include "multitrack.hpp"
+#include "parser.hpp"
+#include "peaks.hpp"
+#include "pushdecoder.hpp"
+#include "swipegen.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <thread>
+
+#include <cstdlib>
+#include <getopt.h>
+
+
+// Minimal time spent on each benchmark (in seconds)
+#define BENCHMARK_TIME 0.5
+
+// Silence and auto threshold used for decoding
+#define BENCHMARK_SILENCE_THRES 5000
+#define BENCHMARK_AUTO_THRES 30
+
+// Swipes decoded before heap allocations are counted, and while counted;
+// collected results pass through several buffers before all have grown
+#define ALLOCATION_WARMUP 8
+#define ALLOCATION_SWIPES 16
+
+// Tracks of the reader whose swipes are collected into cards
+#define ALLOCATION_TRACKS 2
+
+// Samples per block of live input
+#define ALLOCATION_BLOCK 512
+
+// Input buffer filled by a signal without silence (in samples), and
+// how many times its size is written before the decoder counts as stuck
+#define OVERRUN_CAPACITY (1 << 16)
+#define OVERRUN_ROUNDS 64
+
+// Blocks of the signal, and a shorter first block so that the buffer
+// does not fill up at a block boundary (in samples)
+#define OVERRUN_BLOCK 256
+#define OVERRUN_LEAD 100
+// Blocks pushed into a push decoder, of a size not dividing the buffer
+#define OVERRUN_PUSH_BLOCK 300
+
+
+// Heap allocations of the whole program
+static std::atomic<size_t> allocations(0);
+
+void*
+operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+
+    void* memory = std::malloc(size == 0 ? 1 : size);
+    if(memory == NULL)
+        throw std::bad_alloc();
+
+    return memory;
+}
+
+void
+operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void
+operator delete(void* memory, size_t size) noexcept
+{
+    (void) size;
+    std::free(memory);
+}
+
+
+/**
+    Synthetic swipe and everything needed to decode it.
+*/
+struct Swipe
+{
+    std::string format;     // Name of the encoding
+    SwipeParameters params;
+    std::vector<sample_t> samples;
+    BitString bitstring;    // As decoded
+};
+
+// Time per run of a benchmark (in seconds); the setup is not timed
+static double
+measure(const std::function<void(void)>& setup, const std::function<void(void)>& run)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    std::chrono::duration<double> spent(0);
+    size_t runs = 0;
+
+    while(spent.count() < BENCHMARK_TIME)
+    {
+        setup();
+
+        Clock::time_point start = Clock::now();
+        run();
+        spent += Clock::now() - start;
+
+        runs++;
+    }
+
+    return spent.count() / runs;
+}
+
+static void
+report(const char* name, double seconds, const Swipe& swipe)
+{
+    // Keep the format of other output
+    const std::ios::fmtflags flags = std::cout.flags();
+    const std::streamsize precision = std::cout.precision();
+
+    std::cout << "  " << std::left << std::setw(32) << name << std::right
+              << std::fixed << std::setprecision(1)
+              << std::setw(10) << swipe.samples.size() / seconds / 1e6 << " Msamples/s"
+              << std::setw(12) << seconds * 1e9 / swipe.bitstring.size() << " ns/bit"
+              << std::endl;
+
+    std::cout.flags(flags);
+    std::cout.precision(precision);
+}
+
+/**
+    Heap allocations while decoding the same swipe several times in a
+    row, after the decoder has seen it already; none are expected. Live
+    input is decoded while in progress, with its levels measured, and,
+    if collected, on several tracks whose swipes are collected into
+    cards. Returns (size_t) -1 if a swipe was missed.
+*/
+static size_t
+count_allocations(const Swipe& swipe, bool live, bool collected)
+{
+    const unsigned int rounds = ALLOCATION_WARMUP + ALLOCATION_SWIPES;
+    const unsigned int track_count = collected ? ALLOCATION_TRACKS : 1;
+
+    // Every track sees the same swipes
+    std::vector<std::unique_ptr<SampleRing> > rings;
+    std::vector<const SampleRing*> track_rings;
+    for(unsigned int track = 0; track < track_count; track++)
+    {
+        rings.push_back(std::unique_ptr<SampleRing>(
+            new SampleRing(swipe.samples.size() * rounds)));
+
+        for(unsigned int i = 0; i < rounds; i++)
+        {
+            rings[track]->write(&swipe.samples[0], swipe.samples.size());
+        }
+        rings[track]->close();
+
+        track_rings.push_back(rings[track].get());
+    }
+
+    // Levels as measured by the audio callback, a block at a time
+    SignalStats stats;
+    for(size_t i = 0; i < swipe.samples.size(); i += ALLOCATION_BLOCK)
+    {
+        stats.update(&swipe.samples[i], std::min(swipe.samples.size() - i,
+                                                 (size_t) ALLOCATION_BLOCK));
+    }
+
+    std::vector<std::unique_ptr<SwipeDecoder> > decoders;
+    for(unsigned int track = 0; track < track_count; track++)
+    {
+        decoders.push_back(std::unique_ptr<SwipeDecoder>(
+            new SwipeDecoder(BENCHMARK_SILENCE_THRES, BENCHMARK_AUTO_THRES)));
+        decoders[track]->set_streaming(live);
+        if(live)
+            decoders[track]->set_stats(&stats);
+    }
+
+    SwipeCollector collector(track_rings, (swipe.params.sample_rate * END_LENGTH) / 1000);
+    std::vector<SwipeResult> results(track_count);
+    MultiTrackResult card;
+    size_t before = 0;
+
+    for(unsigned int i = 0; i < rounds; i++)
+    {
+        if(i == ALLOCATION_WARMUP)
+            before = allocations.load();
+
+        for(unsigned int track = 0; track < track_count; track++)
+        {
+            SwipeDecoder& decoder = *decoders[track];
+
+            if(! decoder.find_swipe(*rings[track], swipe.params.sample_rate))
+                return (size_t) -1;
+
+            if(collected)
+                collector.begin_swipe(track);
+
+            decoder.decode_swipe(*rings[track], results[track]);
+
+            if(collected)
+                collector.add_swipe(track, decoder.get_swipe_start(), results[track]);
+        }
+
+        while(collected && collector.next_card(card))
+        {
+        }
+    }
+
+    if(collected && collector.card_count() != rounds)
+        return (size_t) -1;
+
+    return allocations.load() - before;
+}
+
+// Loud signal without any silence
+static void
+fill_loud(sample_t* block, size_t count)
+{
+    for(size_t i = 0; i < count; i++)
+    {
+        block[i] = i % 2 == 0 ? 12000 : -12000;
+    }
+}
+
+/**
+    Feed a loud signal without any silence, longer than the input
+    buffer, as live input starting with a block of the given number of
+    samples; the decoder has to end the swipe while input still arrives instead of
+    waiting for room that is never made.
+*/
+static bool
+check_overrun(size_t lead)
+{
+    SampleRing ring(OVERRUN_CAPACITY);
+    std::atomic<bool> found(false);
+
+    std::thread producer([&]()
+    {
+        sample_t block[OVERRUN_BLOCK];
+        fill_loud(block, OVERRUN_BLOCK);
+        ring.write(block, lead);
+
+        for(size_t written = 0; written < OVERRUN_ROUNDS * ring.capacity() && ! found;
+            written += OVERRUN_BLOCK)
+        {
+            ring.write(block, OVERRUN_BLOCK);
+            std::this_thread::yield();
+        }
+
+        ring.close();
+    });
+
+    SwipeDecoder decoder(BENCHMARK_SILENCE_THRES, BENCHMARK_AUTO_THRES);
+    bool ended = decoder.find_swipe(ring, 44100) && ! ring.is_closed();
+    found = true;
+    producer.join();
+
+    std::cout << "Signal longer than the input buffer, first block of " << lead << " samples: "
+              << (ended ? "swipe ended" : "decoder stuck!") << std::endl;
+
+    return ended;
+}
+
+// The same pushed into a push decoder, in blocks of any size
+static bool
+check_push_overrun(void)
+{
+    PushConfig config;
+    config.sample_rate = 44100;
+    config.capacity = OVERRUN_CAPACITY;
+    config.realtime = false;
+    config.streaming = false;
+
+    std::atomic<bool> found(false);
+    PushDecoder decoder(config, [&](const SwipeResult&) { found = true; });
+
+    sample_t block[OVERRUN_PUSH_BLOCK];
+    fill_loud(block, OVERRUN_PUSH_BLOCK);
+
+    for(size_t written = 0; written < OVERRUN_ROUNDS * OVERRUN_CAPACITY && ! found;
+        written += OVERRUN_PUSH_BLOCK)
+    {
+        decoder.push(block, OVERRUN_PUSH_BLOCK);
+        std::this_thread::yield();
+    }
+
+    bool ended = found;
+    decoder.finish();
+
+    std::cout << "Signal longer than the input buffer, pushed in blocks of "
+              << OVERRUN_PUSH_BLOCK << " samples: "
+              << (ended ? "swipe ended" : "decoder stuck!") << std::endl << std::endl;
+
+    return ended;
+}
+
+static bool
+run_benchmarks(Swipe& swipe)
+{
+    const SampleSegment samples(SampleSpan(&swipe.samples[0], swipe.samples.size()));
+    const int auto_thres = BENCHMARK_AUTO_THRES * peak_level(samples) / 100;
+
+    // Decode once to know the bits
+    BiphaseDecoder biphase;
+    biphase.reset(auto_thres, FREQ_THRES);
+    biphase.feed(samples.part(0), swipe.bitstring);
+    biphase.finish(swipe.bitstring);
+
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << swipe.format << " at " << swipe.params.sample_rate << " Hz, "
+              << swipe.params.swipe_speed << " mm/s, "
+              << swipe.params.bit_density << " bits per track, noise "
+              << swipe.params.noise << ": " << swipe.samples.size() << " samples, "
+              << swipe.bitstring.size() << " bits" << std::endl;
+
+    if(swipe.bitstring.empty())
+    {
+        std::cout << "  No bits decoded!" << std::endl;
+        return true;
+    }
+
+    // Timings of a swipe decoded wrongly are still of interest
+    SwipeResult check;
+    EncodingRegistry::standard().parse(swipe.bitstring.view(), check.tracks);
+    if(check.match() == NULL)
+    {
+        std::cout << "  No valid track decoded!" << std::endl;
+    }
+
+    // Detection of the swipe in live input
+    std::unique_ptr<SampleRing> ring;
+    SwipeDecoder decoder(BENCHMARK_SILENCE_THRES, BENCHMARK_AUTO_THRES);
+    report("find_swipe (get_dsp)", measure(
+        [&]()
+        {
+            ring.reset(new SampleRing(swipe.samples.size()));
+            ring->write(&swipe.samples[0], swipe.samples.size());
+            ring->close();
+            decoder.reset();
+        },
+        [&]()
+        {
+            decoder.find_swipe(*ring, swipe.params.sample_rate);
+        }), swipe);
+
+    // Auto threshold
+    report("evaluate_max (peak_level)", measure([]() {  }, [&]()
+        {
+            volatile int level = peak_level(samples);
+            (void) level;
+        }), swipe);
+
+    // Bits out of samples
+    BitString bitstring;
+    report("decode_aiken_biphase", measure([&]() { bitstring.clear(); }, [&]()
+        {
+            biphase.reset(auto_thres, FREQ_THRES);
+            biphase.feed(samples.part(0), bitstring);
+            biphase.finish(bitstring);
+        }), swipe);
+
+    // Characters out of bits
+    std::string result;
+    ABAParser aba_parser;
+    IATAParser iata_parser;
+    MagneticBitstringParser& parser =
+        swipe.format == "IATA" ? (MagneticBitstringParser&) iata_parser : aba_parser;
+    report("MagneticBitstringParser::parse", measure([]() {  }, [&]()
+        {
+            parser.parse(swipe.bitstring.view(), result);
+        }), swipe);
+
+    std::vector<TrackResult> tracks;
+    const EncodingRegistry& encodings = EncodingRegistry::standard();
+    report("EncodingRegistry::parse", measure([&]() { tracks.clear(); }, [&]()
+        {
+            encodings.parse(swipe.bitstring.view(), tracks);
+        }), swipe);
+
+    // Everything after detection
+    SwipeResult swipe_result;
+    report("decode_swipe", measure(
+        [&]()
+        {
+            ring.reset(new SampleRing(swipe.samples.size()));
+            ring->write(&swipe.samples[0], swipe.samples.size());
+            ring->close();
+            decoder.reset();
+            decoder.find_swipe(*ring, swipe.params.sample_rate);
+        },
+        [&]()
+        {
+            decoder.decode_swipe(*ring, swipe_result);
+        }), swipe);
+
+    // Steady state of the decoder: of a file, of live input, and of
+    // the tracks of a reader
+    const char* inputs[] = { "of a file", "of live input", "of collected tracks" };
+    bool steady = true;
+    for(unsigned int i = 0; i < 3; i++)
+    {
+        size_t allocated = count_allocations(swipe, i > 0, i > 1);
+        if(allocated == (size_t) -1)
+        {
+            std::cout << "  Swipes missed while counting heap allocations "
+                      << inputs[i] << "!" << std::endl;
+        }
+        else
+        {
+            std::cout << "  Heap allocations in " << ALLOCATION_SWIPES << " swipes "
+                      << inputs[i] << ": " << allocated << std::endl;
+        }
+
+        steady = steady && allocated == 0;
+    }
+
+    std::cout << std::endl;
+
+    return steady;
+}
+
+static void
+print_help(void)
+{
+    std::cerr << "Usage: mcu_benchmark [OPTIONS]" << std::endl
+              << std::endl
+              << "  -f,  --format       Track format, IATA or ABA (default: ABA)" << std::endl
+              << "  -s,  --speed        Swipe speed in mm/s (default: 500)" << std::endl
+              << "  -d,  --density      Bits per track (default: track format)" << std::endl
+              << "  -n,  --noise        Largest deviation of noise (default: 300)" << std::endl
+              << "  -r,  --sample-rate  Sample rate; by default 44100, 96000" << std::endl
+              << "                      and 192000 one after another" << std::endl
+              << "  -h,  --help         Print this help message" << std::endl;
+}
+
+int
+main(int argc, char** argv)
+{
+    // Getopt variables
+    int ch, option_index;
+    static struct option long_options[] =
+    {
+        {"format",      1, 0, 'f'},
+        {"speed",       1, 0, 's'},
+        {"density",     1, 0, 'd'},
+        {"noise",       1, 0, 'n'},
+        {"sample-rate", 1, 0, 'r'},
+        {"help",        0, 0, 'h'},
+        { 0,            0, 0,  0 }
+    };
+
+    std::string format = "ABA";
+    double speed = 500.0;
+    unsigned int density = 0;
+    int noise = 300;
+    unsigned int sample_rate = 0;
+
+    // Process command line arguments
+    while(true)
+    {
+        ch = getopt_long(argc, argv, "f:s:d:n:r:h", long_options, &option_index);
+
+        if(ch == -1)
+            break;
+
+        switch(ch)
+        {
+            case 'f':
+                format = optarg;
+                break;
+
+            case 's':
+                speed = atof(optarg);
+                break;
+
+            case 'd':
+                density = atoi(optarg);
+                break;
+
+            case 'n':
+                noise = atoi(optarg);
+                break;
+
+            case 'r':
+                sample_rate = atoi(optarg);
+                break;
+
+            case 'h':
+                print_help();
+                exit(EXIT_SUCCESS);
+                break;
+
+            default:
+                print_help();
+                exit(EXIT_FAILURE);
+                break;
+        }
+    }
+
+    // Bit density of a full track as in mcu.ml
+    std::string bits;
+    if(format == "ABA")
+    {
+        bits = encode_track(";1234567890123456=12345?", 5, '0');
+        density = density > 0 ? density : 40 * 5;
+    }
+    else if(format == "IATA")
+    {
+        bits = encode_track("%B1234567890123456^DOE/JOHN^2512?", 7, ' ');
+        density = density > 0 ? density : 79 * 7;
+    }
+    else
+    {
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+
+    std::cout << "Peak search: " << peak_kernel_name() << std::endl << std::endl;
+
+    // Typical sample rates of sound cards unless one is given
+    std::vector<unsigned int> sample_rates;
+    if(sample_rate != 0)
+    {
+        sample_rates.push_back(sample_rate);
+    }
+    else
+    {
+        sample_rates.push_back(44100);
+        sample_rates.push_back(96000);
+        sample_rates.push_back(192000);
+    }
+
+    bool steady = check_overrun(OVERRUN_BLOCK);
+    steady = check_overrun(OVERRUN_LEAD) && steady;
+    steady = check_push_overrun() && steady;
+    for(size_t i = 0; i < sample_rates.size(); i++)
+    {
+        Swipe swipe;
+        swipe.format = format;
+        swipe.params.swipe_speed = speed;
+        swipe.params.bit_density = density;
+        swipe.params.sample_rate = sample_rates[i];
+        swipe.params.amplitude = 12000;
+        swipe.params.noise = noise;
+        encode_aiken_biphase(bits, swipe.params, swipe.samples);
+
+        if(! run_benchmarks(swipe))
+            steady = false;
+    }
+
+    // Decoding must neither get stuck nor allocate once warmed up
+    return steady ? EXIT_SUCCESS : EXIT_FAILURE;
+}
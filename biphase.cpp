@@ -0,0 +1,77 @@
+/**
+    biphase.cpp
+
+    Streaming Aiken bi-phase decoder.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+
+    Based heavily upon dab.c by Joseph Battaglia.
+*/
+
+#include "biphase.hpp"
+
+
+void
+BiphaseDecoder::reset(sample_t thres, int freq_threshold)
+{
+    peaks.reset(thres);
+    intervals.clear();
+    next_interval = 2;  // Decoding starts with the third interval
+    zero = 0;
+    freq_thres = freq_threshold;
+}
+
+void
+BiphaseDecoder::feed(const SampleSpan& block, BitString& bitstring)
+{
+    peaks.feed(block, intervals);
+    decode_intervals(bitstring);
+}
+
+bool
+BiphaseDecoder::finish(BitString& bitstring)
+{
+    peaks.finish(intervals);
+    decode_intervals(bitstring);
+
+    // If less than three peaks found, something went wrong
+    return intervals.size() >= 3;
+}
+
+void
+BiphaseDecoder::decode_intervals(BitString& bitstring)
+{
+    // Decode bits based on intervals between peaks; every interval
+    // is decided together with the one after it
+    for(size_t& i = next_interval; i + 1 < intervals.size(); i++)
+    {
+        // First interval decoded gives the initial length of a zero
+        if(i == 2)
+        {
+            zero = intervals[2];
+        }
+
+        size_t interval0 = (freq_thres * zero) / 100;
+        size_t interval1 = interval0 / 2;
+
+        if(intervals[i] < ((zero / 2) + interval1) &&
+           intervals[i] > ((zero / 2) - interval1))
+        {
+            if(intervals[i + 1] < ((zero / 2) + interval1) &&
+               intervals[i + 1] > ((zero / 2) - interval1))
+            {
+                bitstring.push_back(true);
+                zero = intervals[i] * 2;
+                i++;
+            }
+        }
+        else if(intervals[i] < (zero + interval0) &&
+                intervals[i] > (zero - interval0))
+        {
+            bitstring.push_back(false);
+            zero = intervals[i];
+        }
+    }
+}
@@ -0,0 +1,51 @@
+/**
+    biphase.hpp
+
+    Streaming Aiken bi-phase decoder.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#ifndef BIPHASE_HPP
+#define BIPHASE_HPP
+
+#include <vector>
+
+#include "bitstring.hpp"
+#include "peaks.hpp"
+#include "samples.hpp"
+
+
+/**
+    Aiken bi-phase decoder consuming samples block by block.
+
+    Bits are appended to the bit string as soon as the intervals
+    between peaks reveal them; decoding all samples of a swipe in
+    one block gives the same bits.
+*/
+class BiphaseDecoder
+{
+public:
+    BiphaseDecoder(void) { reset(0, 0); }
+
+    // Start a new swipe; freq_thres is the tolerance in percent
+    void reset(sample_t thres, int freq_thres);
+    // Decode the next block of samples
+    void feed(const SampleSpan& block, BitString& bitstring);
+    // End of the swipe; false if too few peaks were found
+    bool finish(BitString& bitstring);
+
+private:
+    void decode_intervals(BitString& bitstring);
+
+    PeakTracker peaks;
+    std::vector<size_t> intervals;  // Between peaks, in samples
+    size_t next_interval;   // First interval not decoded yet
+    sample_t zero;          // Expected length of a zero bit
+    int freq_thres;
+};
+
+
+#endif /* BIPHASE_HPP */
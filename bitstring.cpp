@@ -0,0 +1,130 @@
+/**
+    bitstring.cpp
+
+    Packed bit strings.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#include "bitstring.hpp"
+
+
+// Index of the lowest set bit; word must not be zero
+static unsigned int
+lowest_bit(uint64_t word)
+{
+#if defined( __GNUC__ )
+    return __builtin_ctzll(word);
+#else
+    unsigned int index = 0;
+    for(; ! (word & 1); word >>= 1)
+    {
+        index++;
+    }
+    return index;
+#endif
+}
+
+// Index of the highest set bit; word must not be zero
+static unsigned int
+highest_bit(uint64_t word)
+{
+#if defined( __GNUC__ )
+    return 63 - __builtin_clzll(word);
+#else
+    unsigned int index = 63;
+    for(; ! (word >> 63); word <<= 1)
+    {
+        index--;
+    }
+    return index;
+#endif
+}
+
+
+uint64_t
+BitView::match_mask(size_t word, uint64_t pattern, unsigned int width) const
+{
+    const size_t word_count = (bits + 63) / 64;
+    const uint64_t low = words[word];
+    const uint64_t high = word + 1 < word_count ? words[word + 1] : 0;
+
+    // Compare 64 positions at once, one pattern bit after another
+    uint64_t mask = ~0ULL;
+    for(unsigned int i = 0; i < width; i++)
+    {
+        uint64_t shifted = i == 0 ? low : (low >> i) | (high << (64 - i));
+
+        mask &= (pattern >> i) & 1 ? shifted : ~shifted;
+    }
+
+    return mask;
+}
+
+size_t
+BitView::find(uint64_t pattern, unsigned int width, size_t from) const
+{
+    if(width == 0 || bits < width || from > bits - width)
+    {
+        return npos;
+    }
+
+    // Last position the pattern fits in, in recorded order
+    const size_t last = bits - width;
+
+    if(! reversed)
+    {
+        for(size_t word = from / 64; word <= last / 64; word++)
+        {
+            uint64_t mask = match_mask(word, pattern, width);
+
+            // Skip positions before the start and behind the end
+            if(word == from / 64)
+                mask &= ~0ULL << (from % 64);
+            if(word == last / 64 && last % 64 != 63)
+                mask &= (1ULL << (last % 64 + 1)) - 1;
+
+            if(mask != 0)
+            {
+                return word * 64 + lowest_bit(mask);
+            }
+        }
+
+        return npos;
+    }
+
+    // Reversed view: search the reversed pattern backwards
+    const uint64_t reversed_pattern = bit_reverse(pattern, width);
+    const size_t first = bits - width - from;
+
+    for(size_t word = first / 64 + 1; word-- > 0; )
+    {
+        uint64_t mask = match_mask(word, reversed_pattern, width);
+
+        if(word == first / 64 && first % 64 != 63)
+            mask &= (1ULL << (first % 64 + 1)) - 1;
+
+        if(mask != 0)
+        {
+            return bits - width - (word * 64 + highest_bit(mask));
+        }
+    }
+
+    return npos;
+}
+
+std::string
+BitView::to_string(void) const
+{
+    std::string result;
+    result.reserve(bits);
+
+    for(size_t i = 0; i < bits; i++)
+    {
+        result.push_back((*this)[i] ? '1' : '0');
+    }
+
+    return result;
+}
@@ -0,0 +1,187 @@
+/**
+    bitstring.hpp
+
+    Packed bit strings.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#ifndef BITSTRING_HPP
+#define BITSTRING_HPP
+
+#include <string>
+#include <vector>
+
+#include <inttypes.h>
+
+
+/**
+    Number of set bits in a word.
+*/
+inline unsigned int
+bit_count(uint64_t word)
+{
+#if defined( __GNUC__ )
+    return __builtin_popcountll(word);
+#else
+    unsigned int count = 0;
+    for(; word != 0; word &= word - 1)
+    {
+        count++;
+    }
+    return count;
+#endif
+}
+
+/**
+    Reverse the order of the lowest count bits of a word.
+*/
+inline uint64_t
+bit_reverse(uint64_t word, unsigned int count)
+{
+    word = ((word >> 1) & 0x5555555555555555ULL) | ((word & 0x5555555555555555ULL) << 1);
+    word = ((word >> 2) & 0x3333333333333333ULL) | ((word & 0x3333333333333333ULL) << 2);
+    word = ((word >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((word & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    word = ((word >> 8) & 0x00FF00FF00FF00FFULL) | ((word & 0x00FF00FF00FF00FFULL) << 8);
+    word = ((word >> 16) & 0x0000FFFF0000FFFFULL) | ((word & 0x0000FFFF0000FFFFULL) << 16);
+    word = (word >> 32) | (word << 32);
+
+    return count == 0 ? 0 : word >> (64 - count);
+}
+
+/**
+    Pattern of up to 64 bits from a string of '0' and '1' characters;
+    the first character becomes the lowest bit.
+*/
+constexpr uint64_t
+bit_pattern(const char* bits)
+{
+    uint64_t pattern = 0;
+
+    for(unsigned int i = 0; bits[i] != '\0' && i < 64; i++)
+    {
+        if(bits[i] == '1')
+        {
+            pattern |= 1ULL << i;
+        }
+    }
+
+    return pattern;
+}
+
+
+/**
+    Read-only view of a bit string, in recorded or in reversed order.
+    Reversing does not copy anything.
+*/
+class BitView
+{
+public:
+    static const size_t npos = (size_t) -1;
+
+    BitView(const uint64_t* data, size_t length, bool reverse) :
+        words(data), bits(length), reversed(reverse) {  }
+    // Same bits in the given order
+    BitView(const BitView& other, bool reverse) :
+        words(other.words), bits(other.bits), reversed(reverse) {  }
+
+    size_t size(void) const { return bits; }
+    bool is_reversed(void) const { return reversed; }
+
+    bool operator[](size_t index) const
+    {
+        size_t pos = reversed ? bits - 1 - index : index;
+        return (words[pos / 64] >> (pos % 64)) & 1;
+    }
+
+    /**
+        Up to 64 bits starting at the given index; bit i of the
+        result is bit index + i of the view.
+    */
+    uint64_t extract(size_t index, unsigned int count) const
+    {
+        if(! reversed)
+            return extract_forward(index, count);
+
+        return bit_reverse(extract_forward(bits - index - count, count), count);
+    }
+
+    /**
+        First index at or after from where the pattern of the given
+        width (as by extract()) starts, or npos.
+    */
+    size_t find(uint64_t pattern, unsigned int width, size_t from = 0) const;
+
+    std::string to_string(void) const;
+
+private:
+    uint64_t extract_forward(size_t pos, unsigned int count) const
+    {
+        size_t word = pos / 64;
+        unsigned int shift = pos % 64;
+        uint64_t value = words[word] >> shift;
+
+        if(shift + count > 64)
+        {
+            value |= words[word + 1] << (64 - shift);
+        }
+
+        return count == 64 ? value : value & ((1ULL << count) - 1);
+    }
+
+    // Word with bit i set if the pattern matches at bit position 64 * word + i
+    uint64_t match_mask(size_t word, uint64_t pattern, unsigned int width) const;
+
+    const uint64_t* words;
+    size_t bits;
+    bool reversed;
+};
+
+
+/**
+    Bit string packed into 64 bit words, first bit lowest.
+*/
+class BitString
+{
+public:
+    BitString(void) : bits(0) {  }
+
+    size_t size(void) const { return bits; }
+    bool empty(void) const { return bits == 0; }
+
+    void clear(void)
+    {
+        words.clear();
+        bits = 0;
+    }
+
+    void push_back(bool bit)
+    {
+        if(bits % 64 == 0)
+        {
+            words.push_back(0);
+        }
+
+        words.back() |= (uint64_t) bit << (bits % 64);
+        bits++;
+    }
+
+    bool operator[](size_t index) const { return view()[index]; }
+
+    // View of the bits, recorded or reversed
+    BitView view(bool reversed = false) const
+    {
+        return BitView(words.empty() ? NULL : &words[0], bits, reversed);
+    }
+
+    std::string to_string(void) const { return view().to_string(); }
+
+private:
+    std::vector<uint64_t> words;
+    size_t bits;
+};
+
+
+#endif /* BITSTRING_HPP */
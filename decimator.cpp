@@ -0,0 +1,98 @@
+/**
+    decimator.cpp
+
+    Reduction of the sample rate of the input.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#include "decimator.hpp"
+
+#include <cassert>
+
+
+// Fraction bits of the gain
+#define DECIMATOR_SHIFT 30
+
+
+Decimator::Decimator(unsigned int decimation) : factor(decimation)
+{
+    assert(factor >= 1 && factor <= MAX_DECIMATION);
+
+    int64_t total_gain = 1;
+    for(unsigned int i = 0; i < DECIMATOR_ORDER; i++)
+    {
+        total_gain *= factor;
+    }
+
+    gain = ((INT64_C(1) << DECIMATOR_SHIFT) + total_gain / 2) / total_gain;
+
+    reset();
+}
+
+void
+Decimator::reset(void)
+{
+    phase = 0;
+
+    for(unsigned int i = 0; i < DECIMATOR_ORDER; i++)
+    {
+        integrators[i] = 0;
+        delays[i] = 0;
+    }
+}
+
+size_t
+Decimator::process(const sample_t* input, size_t count, sample_t* output)
+{
+    // Nothing to filter
+    if(factor == 1)
+    {
+        for(size_t i = 0; i < count; i++)
+        {
+            output[i] = input[i];
+        }
+
+        return count;
+    }
+
+    size_t written = 0;
+    for(size_t i = 0; i < count; i++)
+    {
+        // Integrators run at the input rate
+        uint32_t value = (uint32_t) (int32_t) input[i];
+        for(unsigned int stage = 0; stage < DECIMATOR_ORDER; stage++)
+        {
+            integrators[stage] += value;
+            value = integrators[stage];
+        }
+
+        if(++phase < factor)
+            continue;
+
+        phase = 0;
+
+        // Combs run at the output rate
+        for(unsigned int stage = 0; stage < DECIMATOR_ORDER; stage++)
+        {
+            uint32_t difference = value - delays[stage];
+            delays[stage] = value;
+            value = difference;
+        }
+
+        // Remove the gain, rounding to nearest
+        int64_t scaled = (int64_t) (int32_t) value * gain;
+        scaled = (scaled + (INT64_C(1) << (DECIMATOR_SHIFT - 1))) >> DECIMATOR_SHIFT;
+
+        if(scaled > 32767)
+            scaled = 32767;
+        else if(scaled < -32768)
+            scaled = -32768;
+
+        output[written++] = (sample_t) scaled;
+    }
+
+    return written;
+}
@@ -0,0 +1,67 @@
+/**
+    decimator.hpp
+
+    Reduction of the sample rate of the input.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#ifndef DECIMATOR_HPP
+#define DECIMATOR_HPP
+
+#include <cstddef>
+
+#include <inttypes.h>
+
+#include "samples.hpp"
+
+
+// Stages of integrators and combs
+#define DECIMATOR_ORDER 3
+
+// Largest decimation factor; the sums of the stages must fit in 32 bits
+#define MAX_DECIMATION 16
+
+// Decimated samples per step of the producer of live input
+#define DECIMATE_CHUNK 1024
+
+
+/**
+    Cascaded integrator-comb (CIC) decimator.
+
+    Every output sample is the moving average of the input, taken
+    DECIMATOR_ORDER times, at every factor-th sample. Integrators wrap
+    around in fixed point without harm, as the combs take differences
+    only. The gain of factor^DECIMATOR_ORDER is removed by a
+    multiplication and a shift. State is kept between blocks, so blocks
+    may have any length.
+*/
+class Decimator
+{
+public:
+    Decimator(unsigned int decimation = 1);
+
+    unsigned int get_factor(void) const { return factor; }
+
+    // Forget the samples seen so far
+    void reset(void);
+
+    /**
+        Decimate a block; returns the number of samples written to
+        output, at most (count + factor - 1) / factor.
+    */
+    size_t process(const sample_t* input, size_t count, sample_t* output);
+
+private:
+    unsigned int factor;
+    unsigned int phase;     // Input samples since the last output
+    int64_t gain;           // Reciprocal of factor^DECIMATOR_ORDER, in fixed point
+
+    uint32_t integrators[DECIMATOR_ORDER];
+    uint32_t delays[DECIMATOR_ORDER];   // Last input of every comb
+};
+
+
+#endif /* DECIMATOR_HPP */
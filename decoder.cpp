@@ -0,0 +1,613 @@
+/**
+    decoder.cpp
+
+    Detection and decoding of swipes.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+
+    Based heavily upon dab.c and dmsb.c by Joseph Battaglia.
+*/
+
+#include "decoder.hpp"
+#include "soundfile.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+
+ArchiveOutcome
+archive_outcome(const SwipeResult& result)
+{
+    if(result.match() != NULL)
+        return ARCHIVE_VALID;
+
+    return result.bits_found ? ARCHIVE_INVALID : ARCHIVE_NO_BITS;
+}
+
+
+SwipeDecoder::SwipeDecoder(sample_t silence_threshold, int auto_threshold) :
+        buffer_index(0), sample_start(0), sample_end(0),
+        silence_thres(silence_threshold), detect_thres(silence_threshold),
+        auto_thres(auto_threshold), stats(NULL), metrics(NULL),
+        encodings(&EncodingRegistry::standard()), recovery(NULL),
+        archive(NULL), input_rate(0),
+        streaming(false), stream_state(STREAM_OFF), stream_position(0),
+        stream_thres(silence_threshold)
+{
+}
+
+template<class Buffer>
+bool
+SwipeDecoder::find_swipe(Buffer& input, unsigned int sample_rate)
+{
+    // Skip the rest of a swipe reported while in progress
+    if(stream_state == STREAM_DONE)
+    {
+        stream_state = STREAM_OFF;
+        get_dsp(input, sample_rate);
+    }
+
+    if(! silence_pause(input))
+    {
+        return false;
+    }
+
+    input_rate = sample_rate;
+
+    uint64_t swipe_start = metrics != NULL ? monotonic_ns() : 0;
+
+    // Decode the swipe while it arrives
+    if(streaming)
+    {
+        stream_state = STREAM_DECODING;
+        stream_position = buffer_index;
+        stream_result.clear();
+        biphase.reset(stream_thres, FREQ_THRES);
+    }
+
+    bool found = get_dsp(input, sample_rate);
+
+    if(metrics != NULL && found)
+    {
+        metrics->swipe_time.record(monotonic_ns() - swipe_start);
+    }
+
+    return found;
+}
+
+template<class Buffer>
+bool
+SwipeDecoder::decode_swipe(Buffer& input, SwipeResult& result)
+{
+    result.bits_found = false;
+    result.recovered = false;
+    result.freq_thres = FREQ_THRES;
+    result.clear();
+
+    // Swipe already decoded while in progress
+    if(stream_state == STREAM_DONE)
+    {
+        // Samples up to the point the swipe validated; after an error
+        // the archive is left alone
+        if(archive != NULL &&
+           ! archive->append(segment(input, sample_start, stream_position), input_rate,
+                             ARCHIVE_VALID, archive_source))
+        {
+            archive = NULL;
+        }
+
+        input.release(buffer_index);
+
+        std::swap(result, stream_result);
+        result.bits_found = true;
+        result.recovered = false;
+        result.freq_thres = FREQ_THRES;
+        result.silence_thres = stream_thres;
+        return true;
+    }
+
+    stream_state = STREAM_OFF;
+
+    // Samples of the swipe, in place
+    SampleSegment samples = segment(input, sample_start, sample_end);
+    decode_segment(samples, result);
+
+    if(archive != NULL &&
+       ! archive->append(samples, input_rate, archive_outcome(result), archive_source))
+    {
+        archive = NULL;
+    }
+
+    // Samples up to the end of the swipe are not needed anymore; they
+    // are decoded in place, so not before now
+    input.release(buffer_index);
+
+    return result.bits_found;
+}
+
+bool
+SwipeDecoder::decode_segment(const SampleSegment& samples, SwipeResult& result)
+{
+    result.bits_found = false;
+    result.recovered = false;
+    result.freq_thres = FREQ_THRES;
+    result.clear();
+
+    // Automatically set threshold if requested
+    result.silence_thres = silence_thres;
+    if(auto_thres > 0)
+    {
+        result.silence_thres = auto_thres * evaluate_max(samples) / 100;
+    }
+
+    // Decode result
+    uint64_t decode_start = metrics != NULL ? monotonic_ns() : 0;
+    bool decoded = decode_aiken_biphase(samples, result.silence_thres, result.bitstring);
+
+    if(metrics != NULL)
+    {
+        metrics->decode_time.record(monotonic_ns() - decode_start);
+    }
+
+    if(decoded)
+    {
+        result.bits_found = true;
+
+        uint64_t parse_start = metrics != NULL ? monotonic_ns() : 0;
+        parse_bitstring(result);
+
+        if(metrics != NULL)
+        {
+            metrics->parse_time.record(monotonic_ns() - parse_start);
+        }
+
+        // Calibrated threshold is used for streaming the next swipe
+        stream_thres = result.silence_thres;
+    }
+
+    // Other thresholds may still reveal a valid track
+    if(recovery != NULL && result.match() == NULL)
+    {
+        recover(samples, result);
+    }
+
+    return result.bits_found;
+}
+
+template<class Buffer>
+bool
+SwipeDecoder::stream_swipe(Buffer& input, size_t position)
+{
+    // Decode only when waiting for input is due
+    if(stream_state != STREAM_DECODING || position <= input.size())
+    {
+        return false;
+    }
+
+    // Decode all samples that arrived so far
+    const size_t end = input.size();
+    const size_t old_bits = stream_result.bitstring.size();
+
+    SampleSegment samples = segment(input, stream_position, end);
+    for(size_t i = 0; i < samples.part_count(); i++)
+    {
+        biphase.feed(samples.part(i), stream_result.bitstring);
+    }
+
+    stream_position = end;
+
+    if(stream_result.bitstring.size() == old_bits)
+    {
+        return false;
+    }
+
+    // Accept a track only with its LRC character, which arrives last
+    stream_result.clear_tracks();
+    encodings->parse(stream_result.bitstring.view(), stream_result.tracks, true,
+                     &stream_result.spare_tracks);
+
+    if(stream_result.match() == NULL)
+    {
+        return false;
+    }
+
+    stream_state = STREAM_DONE;
+    return true;
+}
+
+void
+SwipeDecoder::parse_bitstring(SwipeResult& result)
+{
+    // Try decoding using all configured parsers, in both directions
+    encodings->parse(result.bitstring.view(), result.tracks, false, &result.spare_tracks);
+}
+
+template<class Buffer>
+bool
+SwipeDecoder::silence_pause(Buffer& input)
+{
+    // Measure the loudest sample of the next swipe
+    if(stats != NULL)
+    {
+        stats->mark();
+    }
+
+    while(true)
+    {
+        // Silent samples are not needed anymore
+        input.release(buffer_index);
+
+        // Wait till buffer has enough data
+        if(! input.wait(buffer_index + 1))
+        {
+            return false;
+        }
+
+        // Follow the noise of the input while it is silent
+        adapt_threshold();
+
+        for(; buffer_index < input.size(); buffer_index++)
+        {
+            // On first sample with absolute value
+            // greater than threshold bail out
+            sample_t sample = input.at(buffer_index);
+
+            if(sample < 0)
+            {
+                sample = -sample;
+            }
+
+            if(sample > detect_thres)
+            {
+                return true;
+            }
+        }
+    }
+}
+
+template<class Buffer>
+bool
+SwipeDecoder::get_dsp(Buffer& input, unsigned int sample_rate)
+{
+    // Set start of the sample; nothing before it is kept
+    sample_start = buffer_index;
+    sample_end = sample_start;
+    input.release(sample_start);
+
+    // Silence interval (in samples) indicating end of the sample
+    size_t silence_interval = (sample_rate * END_LENGTH) / 1000;
+
+    // Samples of the swipe the input can keep at once
+    const size_t max_length = capacity(input);
+
+    // Loop until the end of the sample is found
+    while(true)
+    {
+        // Find supposed end of sample (sample below threshold)
+        for(; ; buffer_index++)
+        {
+            // Report a streamed swipe as soon as it is complete
+            if(stream_swipe(input, buffer_index + 1))
+            {
+                sample_end = buffer_index;
+                return true;
+            }
+
+            // A swipe filling the whole input buffer ends there; no
+            // further samples would arrive while it is kept
+            if(buffer_index - sample_start >= max_length)
+            {
+                sample_end = buffer_index;
+                return true;
+            }
+
+            // Wait till buffer has enough data; at the end
+            // of input the sample ends with it
+            if(! input.wait(buffer_index + 1))
+            {
+                sample_end = buffer_index;
+                return sample_end > sample_start;
+            }
+
+            sample_t sample = input.at(buffer_index);
+
+            if(sample < 0)
+            {
+                sample = -sample;
+            }
+
+            if(sample < detect_thres)
+            {
+                sample_end = buffer_index;
+                break;
+            }
+        }
+
+        // Report a streamed swipe as soon as it is complete
+        if(stream_swipe(input, buffer_index + silence_interval))
+        {
+            return true;
+        }
+
+        // Wait till buffer has enough data; at the end of input,
+        // or of the input buffer, the remaining samples have to suffice
+        size_t silence_length = std::min(silence_interval,
+                                         max_length - (buffer_index - sample_start));
+        if(! input.wait(buffer_index + silence_length))
+        {
+            silence_length = input.size() - buffer_index;
+        }
+
+        // Check whether the supposed end of the sample is the real one
+        size_t silence_counter;
+        for(silence_counter = 0;
+            silence_counter < silence_length;
+            silence_counter++, buffer_index++)
+        {
+            sample_t sample = input.at(buffer_index);
+
+            if(sample < 0)
+            {
+                sample = -sample;
+            }
+
+            if(sample > detect_thres)
+            {
+                break;
+            }
+        }
+
+        // If silence continued longer than the allowed interval, end recording
+        if(silence_counter == silence_length)
+        {
+            return true;
+        }
+    }
+}
+
+bool
+SwipeDecoder::decode_aiken_biphase(const SampleSegment& input, sample_t thres,
+                                   BitString& bitstring)
+{
+    // Decode all samples in one go
+    biphase.reset(thres, FREQ_THRES);
+    for(size_t i = 0; i < input.part_count(); i++)
+    {
+        biphase.feed(input.part(i), bitstring);
+    }
+
+    return biphase.finish(bitstring);
+}
+
+/**
+    Re-decoding of a swipe with other thresholds, shared by the
+    decoder and the helpers it submitted to the pool. Helpers that
+    start late find no work left and never touch the samples.
+*/
+struct Recovery
+{
+    SampleSegment samples;
+    const EncodingRegistry* encodings;
+    std::vector<std::pair<sample_t, int> > candidates;  // Silence and frequency thresholds
+
+    std::atomic<size_t> next;   // First candidate not taken yet
+    std::atomic<size_t> best;   // Nearest candidate with a valid track
+
+    std::mutex mutex;
+    std::condition_variable all_done;
+    size_t done;
+    SwipeResult result;         // Of the best candidate
+};
+
+// Decode candidates until none is left
+static void
+recover_candidates(const std::shared_ptr<Recovery>& recovery)
+{
+    const size_t count = recovery->candidates.size();
+
+    while(true)
+    {
+        const size_t index = recovery->next.fetch_add(1);
+        if(index >= count)
+            return;
+
+        // A nearer candidate may have succeeded meanwhile
+        SwipeResult candidate;
+        candidate.silence_thres = recovery->candidates[index].first;
+        candidate.freq_thres = recovery->candidates[index].second;
+
+        BiphaseDecoder biphase;
+        biphase.reset(candidate.silence_thres, candidate.freq_thres);
+
+        bool cancelled = index > recovery->best.load();
+        for(size_t i = 0; i < recovery->samples.part_count() && ! cancelled; i++)
+        {
+            const SampleSpan& part = recovery->samples.part(i);
+
+            for(size_t start = 0; start < part.size(); start += RECOVERY_CHUNK)
+            {
+                if(index > recovery->best.load())
+                {
+                    cancelled = true;
+                    break;
+                }
+
+                size_t end = std::min(start + RECOVERY_CHUNK, part.size());
+                biphase.feed(part.subspan(start, end), candidate.bitstring);
+            }
+        }
+
+        if(! cancelled && biphase.finish(candidate.bitstring))
+        {
+            recovery->encodings->parse(candidate.bitstring.view(), candidate.tracks);
+
+            if(candidate.match() != NULL)
+            {
+                std::lock_guard<std::mutex> lock(recovery->mutex);
+
+                if(index < recovery->best.load())
+                {
+                    recovery->best.store(index);
+                    std::swap(recovery->result, candidate);
+                }
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(recovery->mutex);
+        if(++recovery->done == count)
+        {
+            recovery->all_done.notify_all();
+        }
+    }
+}
+
+void
+SwipeDecoder::recover(const SampleSegment& samples, SwipeResult& result)
+{
+    std::shared_ptr<Recovery> state = std::make_shared<Recovery>();
+    state->samples = samples;
+    state->encodings = encodings;
+    state->next = 0;
+    state->best = (size_t) -1;
+    state->done = 0;
+
+    // Grid around the thresholds used, nearest first
+    std::vector<std::pair<int, std::pair<sample_t, int> > > grid;
+    for(int thres = RECOVERY_THRES_MIN; thres <= RECOVERY_THRES_MAX; thres += RECOVERY_THRES_STEP)
+    {
+        for(int freq = RECOVERY_FREQ_MIN; freq <= RECOVERY_FREQ_MAX; freq += RECOVERY_FREQ_STEP)
+        {
+            if(thres == 100 && freq == FREQ_THRES)
+                continue;
+
+            int distance = abs(thres - 100) / RECOVERY_THRES_STEP +
+                           abs(freq - FREQ_THRES) / RECOVERY_FREQ_STEP;
+            sample_t silence = (sample_t) std::max(1, result.silence_thres * thres / 100);
+
+            grid.push_back(std::make_pair(distance, std::make_pair(silence, freq)));
+        }
+    }
+
+    std::stable_sort(grid.begin(), grid.end(),
+        [](const std::pair<int, std::pair<sample_t, int> >& a,
+           const std::pair<int, std::pair<sample_t, int> >& b)
+        {
+            return a.first < b.first;
+        });
+
+    for(size_t i = 0; i < grid.size(); i++)
+    {
+        state->candidates.push_back(grid[i].second);
+    }
+
+    // Spread the candidates over the pool and decode them here too, so
+    // that a decoder running on the pool itself cannot wait for nothing
+    for(unsigned int i = 0; i < recovery->size(); i++)
+    {
+        recovery->submit([state](unsigned int) { recover_candidates(state); });
+    }
+
+    recover_candidates(state);
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    while(state->done < state->candidates.size())
+    {
+        state->all_done.wait(lock);
+    }
+
+    if(state->best.load() == (size_t) -1)
+    {
+        return;
+    }
+
+    std::swap(result, state->result);
+    result.bits_found = true;
+    result.recovered = true;
+}
+
+void
+SwipeDecoder::adapt_threshold(void)
+{
+    if(stats == NULL)
+    {
+        return;
+    }
+
+    // Keep the threshold well above the noise, but never below the
+    // configured one
+    int noise_thres = NOISE_MARGIN * stats->noise_floor();
+
+    detect_thres = silence_thres;
+    if(noise_thres > silence_thres)
+    {
+        detect_thres = noise_thres > SHRT_MAX ? SHRT_MAX : (sample_t) noise_thres;
+    }
+
+    // Swipes must not raise the noise floor
+    stats->set_quiet_level(detect_thres);
+}
+
+int
+SwipeDecoder::evaluate_max(const SampleSegment& samples)
+{
+    // Maintained while the samples arrived
+    if(stats != NULL)
+    {
+        return stats->peak();
+    }
+
+    // Loudest sample of the swipe, negative ones included
+    return peak_level(samples);
+}
+
+size_t
+SwipeDecoder::capacity(SampleRing& input)
+{
+    return input.capacity();
+}
+
+size_t
+SwipeDecoder::capacity(SoundFile& input)
+{
+    // Recordings are kept whole
+    (void) input;
+    return (size_t) -1;
+}
+
+SampleSegment
+SwipeDecoder::segment(SampleRing& input, size_t start, size_t end)
+{
+    // Samples in the ring, in two parts if they wrap around
+    SampleSegment samples;
+    while(start < end)
+    {
+        size_t count;
+        const sample_t* data = input.contiguous(start, end, count);
+
+        samples.append(SampleSpan(data, count));
+        start += count;
+    }
+
+    return samples;
+}
+
+SampleSegment
+SwipeDecoder::segment(SoundFile& input, size_t start, size_t end)
+{
+    // Mapped samples are used in place
+    return SampleSegment(input.span(start, end));
+}
+
+// Inputs the decoder is used with
+template bool SwipeDecoder::find_swipe<SampleRing>(SampleRing&, unsigned int);
+template bool SwipeDecoder::find_swipe<SoundFile>(SoundFile&, unsigned int);
+template bool SwipeDecoder::decode_swipe<SampleRing>(SampleRing&, SwipeResult&);
+template bool SwipeDecoder::decode_swipe<SoundFile>(SoundFile&, SwipeResult&);
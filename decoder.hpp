@@ -0,0 +1,259 @@
+/**
+    decoder.hpp
+
+    Detection and decoding of swipes.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#ifndef DECODER_HPP
+#define DECODER_HPP
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "biphase.hpp"
+#include "bitstring.hpp"
+#include "encodings.hpp"
+#include "metrics.hpp"
+#include "parser.hpp"
+#include "ringbuffer.hpp"
+#include "samples.hpp"
+#include "signalstats.hpp"
+#include "threadpool.hpp"
+
+
+// Recording mapped into memory (soundfile.hpp)
+class SoundFile;
+
+
+// Initial silence threshold
+#define SILENCE_THRES 5000
+
+// Percent of highest value to set silence_thres to
+#define AUTO_THRES 30
+
+// Frequency threshold (in percent)
+#define FREQ_THRES 60
+
+// Silence interval after sample (in milliseconds)
+#define END_LENGTH 200
+
+// Detection threshold relative to the noise floor (factor)
+#define NOISE_MARGIN 6
+
+// Silence thresholds tried to recover a swipe (in percent of the calibrated one)
+#define RECOVERY_THRES_MIN 40
+#define RECOVERY_THRES_MAX 160
+#define RECOVERY_THRES_STEP 20
+
+// Frequency thresholds tried to recover a swipe (in percent)
+#define RECOVERY_FREQ_MIN 40
+#define RECOVERY_FREQ_MAX 80
+#define RECOVERY_FREQ_STEP 5
+
+// Samples decoded between checks whether a recovery attempt is still needed
+#define RECOVERY_CHUNK 4096
+
+// Capacity of the input ring buffer (in samples; about 5 s at 192 kHz)
+#define RING_BUFFER_SIZE (1 << 20)
+
+// Input buffer shared between the RtAudio callback and the decoder
+typedef RingBuffer<sample_t> SampleRing;
+
+
+/**
+    Result of decoding a single swipe.
+
+    A result reused for the next swipe keeps the memory of its bits
+    and tracks; once it has seen the longest swipe, decoding into it
+    allocates nothing.
+*/
+struct SwipeResult
+{
+    bool bits_found;        // Whether any bits were detected
+    sample_t silence_thres; // Threshold used for decoding
+    int freq_thres;         // Frequency threshold used for decoding
+    bool recovered;         // Decoded again with other thresholds
+    BitString bitstring;    // String of bits
+    std::vector<TrackResult> tracks;    // Candidates found by the parsers
+    std::vector<TrackResult> spare_tracks;  // Cleared tracks, reused by the parsers
+
+    // Forget the tracks; their strings are kept for the next ones
+    void clear_tracks(void)
+    {
+        for(size_t i = 0; i < tracks.size(); i++)
+        {
+            spare_tracks.push_back(std::move(tracks[i]));
+        }
+
+        tracks.clear();
+    }
+
+    // Forget bits and tracks
+    void clear(void)
+    {
+        bitstring.clear();
+        clear_tracks();
+    }
+
+    // First track decoded without errors, or NULL
+    const TrackResult* match(void) const
+    {
+        for(size_t i = 0; i < tracks.size(); i++)
+        {
+            if(tracks[i].status == PARSE_OK)
+                return &tracks[i];
+        }
+
+        return NULL;
+    }
+};
+
+/**
+    Outcome of decoding a swipe when it was archived.
+*/
+enum ArchiveOutcome
+{
+    ARCHIVE_VALID,      // A track was decoded without errors
+    ARCHIVE_INVALID,    // Bits, but no valid track
+    ARCHIVE_NO_BITS     // No bits detected
+};
+
+// Outcome of a swipe as recorded in archives
+ArchiveOutcome archive_outcome(const SwipeResult& result);
+
+/**
+    Archive the decoders append the samples of every swipe to, from
+    any thread; ArchiveWriter (archive.hpp) stores them in a file.
+*/
+class SwipeArchive
+{
+public:
+    virtual ~SwipeArchive(void) {  }
+
+    // Append the samples of a swipe; false if the archive failed, in
+    // which case nothing more is appended
+    virtual bool append(const SampleSegment& samples, unsigned int sample_rate,
+                        ArchiveOutcome outcome, const std::string& source) = 0;
+};
+
+
+/**
+    Detection and decoding of swipes in one input.
+
+    All state of a swipe lives in the decoder, so independent decoders
+    may run on different threads. Buffer is either a SampleRing
+    (live input) or a SoundFile (recording).
+
+    When streaming, samples are decoded while the swipe is still in
+    progress, whenever the decoder would otherwise wait for input. As
+    soon as a track validates the swipe is reported without waiting
+    for the trailing silence, and the rest of it is skipped later.
+    The threshold of a streamed swipe is the one calibrated on the
+    previous swipe, or the silence threshold at first. A swipe (or
+    noise) filling the whole ring buffer ends there, as the producer
+    could not store any further samples.
+
+    With statistics of live input, the auto threshold is taken from
+    the peak measured by the producer, and the detection threshold
+    rises with the noise floor of the input.
+
+    With a recovery pool, a swipe without a valid track is decoded
+    again on the pool over a grid of silence and frequency thresholds,
+    nearest to the calibrated ones first. The nearest candidate with a
+    valid track is taken; candidates farther away are skipped or
+    abandoned once one is found.
+
+    With an archive, the samples of every swipe are appended to it
+    before they are released; a streamed swipe up to where it
+    validated.
+*/
+class SwipeDecoder
+{
+public:
+    SwipeDecoder(sample_t silence_threshold, int auto_threshold);
+
+    // Start over at the beginning of a new input
+    void reset(void) { buffer_index = 0; }
+    size_t get_position(void) const { return buffer_index; }
+    // Decode live input while the swipe is in progress
+    void set_streaming(bool enable) { streaming = enable; }
+    // Statistics maintained by the producer of live input, or NULL
+    void set_stats(SignalStats* signal_stats) { stats = signal_stats; }
+    // Record timings of the swipes, or not if NULL
+    void set_metrics(Metrics* pipeline_metrics) { metrics = pipeline_metrics; }
+    // Encodings to try, e.g. only the one of a known track; the
+    // registry must outlive the decoder
+    void set_encodings(const EncodingRegistry& registry) { encodings = &registry; }
+    // Position of the first sample of the swipe found last
+    size_t get_swipe_start(void) const { return sample_start; }
+    // Re-decode swipes without a valid track on the pool, or not if NULL
+    void set_recovery(ThreadPool* pool) { recovery = pool; }
+    // Append swipes to the archive, or not if NULL
+    void set_archive(SwipeArchive* writer, const std::string& source)
+    {
+        archive = writer;
+        archive_source = source;
+    }
+
+    // Wait for the next swipe; false at the end of input
+    template<class Buffer> bool find_swipe(Buffer& input, unsigned int sample_rate);
+    // Decode the swipe found last; false if no bits were detected
+    template<class Buffer> bool decode_swipe(Buffer& input, SwipeResult& result);
+    // Decode samples of a swipe, e.g. from an archive; false if no
+    // bits were detected
+    bool decode_segment(const SampleSegment& samples, SwipeResult& result);
+
+private:
+    // Methods
+    template<class Buffer> bool silence_pause(Buffer& input);
+    template<class Buffer> bool get_dsp(Buffer& input, unsigned int sample_rate);
+    void adapt_threshold(void);
+    int evaluate_max(const SampleSegment& samples);
+    template<class Buffer> bool stream_swipe(Buffer& input, size_t position);
+    size_t capacity(SampleRing& input);
+    size_t capacity(SoundFile& input);
+    SampleSegment segment(SampleRing& input, size_t start, size_t end);
+    SampleSegment segment(SoundFile& input, size_t start, size_t end);
+    bool decode_aiken_biphase(const SampleSegment& input, sample_t thres,
+                              BitString& bitstring);
+    void parse_bitstring(SwipeResult& result);
+    void recover(const SampleSegment& samples, SwipeResult& result);
+
+    // Properties
+    size_t buffer_index;  // Current buffer index  = 0
+    // Start and end index of sample
+    size_t sample_start;
+    size_t sample_end;
+    sample_t silence_thres; // Configured silence threshold
+    sample_t detect_thres;  // Silence threshold used to detect swipes
+    int auto_thres; // Percent of maximum to decode with; 0 if fixed
+    SignalStats* stats; // Of live input; NULL for recordings
+    Metrics* metrics;   // NULL if not measured
+    const EncodingRegistry* encodings;  // Standard encodings by default
+    ThreadPool* recovery;   // NULL if swipes are not recovered
+    SwipeArchive* archive;  // NULL if swipes are not archived
+    std::string archive_source;
+    unsigned int input_rate;    // Sample rate of the swipe found last
+    BiphaseDecoder biphase;
+
+    // Decoding while the swipe is in progress
+    enum StreamState
+    {
+        STREAM_OFF,         // Not decoding
+        STREAM_DECODING,    // Swipe in progress, no valid track yet
+        STREAM_DONE         // Track validated, rest of the swipe pending
+    };
+    bool streaming;
+    StreamState stream_state;
+    size_t stream_position; // Next sample to decode
+    sample_t stream_thres;  // Threshold calibrated on the last swipe
+    SwipeResult stream_result;
+};
+
+
+#endif /* DECODER_HPP */
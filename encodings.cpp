@@ -0,0 +1,463 @@
+/**
+    encodings.cpp
+
+    Registry of track encodings, decoded at runtime by tables of
+    characters generated at compile time for the standard encodings.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#include "encodings.hpp"
+
+#include <deque>
+#include <sstream>
+#include <utility>
+
+#include <cstdlib>
+
+
+// Marks a missing transition while the trie is built
+#define NO_STATE ((uint32_t) -1)
+
+
+bool
+Encoding::parse(const char* spec, Encoding& encoding)
+{
+    // Split into fields
+    std::vector<std::string> fields;
+    std::istringstream input(spec);
+    std::string field;
+    while(std::getline(input, field, ':'))
+    {
+        fields.push_back(field);
+    }
+
+    if(fields.size() < 5 || fields.size() > 6 || fields[0].empty())
+        return false;
+
+    // Characters of up to 8 bits, parity included
+    int char_length = atoi(fields[1].c_str());
+    if(char_length < 2 || char_length > 8)
+        return false;
+
+    // Sentinels as strings of bits, one character long
+    for(size_t i = 2; i <= 3; i++)
+    {
+        if(fields[i].size() != (size_t) char_length ||
+           fields[i].find_first_not_of("01") != std::string::npos)
+            return false;
+    }
+
+    if(fields[4].size() != 1)
+        return false;
+
+    encoding.name = fields[0];
+    encoding.char_length = char_length;
+    encoding.start_sentinel = bit_pattern(fields[2].c_str());
+    encoding.end_sentinel = bit_pattern(fields[3].c_str());
+    encoding.charset_begin = fields[4][0];
+    encoding.max_chars = fields.size() > 5 ? atoi(fields[5].c_str()) : 0;
+    encoding.table = NULL;
+
+    return true;
+}
+
+
+void
+SentinelAutomaton::build(const std::vector<uint64_t>& patterns,
+                         const std::vector<unsigned int>& pattern_widths)
+{
+    pattern_count = patterns.size();
+    widths = pattern_widths;
+
+    // Trie of all patterns; transitions of state s at 2 s and 2 s + 1
+    std::vector<uint32_t> trie(2, NO_STATE);
+    outputs.assign(1, std::vector<unsigned int>());
+
+    for(size_t p = 0; p < pattern_count; p++)
+    {
+        if(widths[p] == 0)
+            continue;
+
+        uint32_t state = 0;
+        for(unsigned int i = 0; i < widths[p]; i++)
+        {
+            unsigned int bit = (patterns[p] >> i) & 1;
+
+            if(trie[2 * state + bit] == NO_STATE)
+            {
+                trie[2 * state + bit] = (uint32_t) outputs.size();
+                trie.push_back(NO_STATE);
+                trie.push_back(NO_STATE);
+                outputs.push_back(std::vector<unsigned int>());
+            }
+
+            state = trie[2 * state + bit];
+        }
+
+        outputs[state].push_back((unsigned int) p);
+    }
+
+    // Failure links, breadth first; missing transitions follow them
+    const size_t state_count = outputs.size();
+    std::vector<uint32_t> fail(state_count, 0);
+    std::deque<uint32_t> queue;
+
+    delta.assign(2 * state_count, 0);
+    for(unsigned int bit = 0; bit < 2; bit++)
+    {
+        if(trie[bit] != NO_STATE)
+        {
+            delta[bit] = trie[bit];
+            queue.push_back(trie[bit]);
+        }
+    }
+
+    while(! queue.empty())
+    {
+        uint32_t state = queue.front();
+        queue.pop_front();
+
+        // Patterns ending in the longest proper suffix end here too
+        const std::vector<unsigned int>& inherited = outputs[fail[state]];
+        outputs[state].insert(outputs[state].end(), inherited.begin(), inherited.end());
+
+        for(unsigned int bit = 0; bit < 2; bit++)
+        {
+            uint32_t next = trie[2 * state + bit];
+
+            if(next == NO_STATE)
+            {
+                delta[2 * state + bit] = delta[2 * fail[state] + bit];
+            }
+            else
+            {
+                delta[2 * state + bit] = next;
+                fail[next] = delta[2 * fail[state] + bit];
+                queue.push_back(next);
+            }
+        }
+    }
+
+    // Eight transitions at once, with the patterns ending meanwhile
+    steps.assign(state_count * 256, 0);
+    step_matches.assign(state_count * 256 + 1, 0);
+    matches.clear();
+    for(uint32_t state = 0; state < state_count; state++)
+    {
+        for(unsigned int byte = 0; byte < 256; byte++)
+        {
+            uint32_t next = state;
+
+            step_matches[state * 256 + byte] = (uint32_t) matches.size();
+            for(unsigned int i = 0; i < 8; i++)
+            {
+                next = delta[2 * next + ((byte >> i) & 1)];
+
+                for(size_t j = 0; j < outputs[next].size(); j++)
+                {
+                    Match match = { outputs[next][j], i };
+                    matches.push_back(match);
+                }
+            }
+
+            steps[state * 256 + byte] = next;
+        }
+    }
+
+    step_matches[state_count * 256] = (uint32_t) matches.size();
+}
+
+void
+SentinelAutomaton::search(const BitView& bitstring, size_t* first, size_t* last) const
+{
+    for(size_t p = 0; p < pattern_count; p++)
+    {
+        first[p] = BitView::npos;
+        last[p] = BitView::npos;
+    }
+
+    if(outputs.size() <= 1)
+        return;
+
+    const size_t size = bitstring.size();
+    uint32_t state = 0;
+    size_t index = 0;
+
+    // Record a pattern ending at the given bit
+    auto report = [&](unsigned int pattern, size_t end)
+    {
+        size_t start = end + 1 - widths[pattern];
+
+        if(first[pattern] == BitView::npos)
+            first[pattern] = start;
+        last[pattern] = start;
+    };
+
+    // Byte by byte
+    for(; index + 64 <= size; index += 64)
+    {
+        uint64_t word = bitstring.extract(index, 64);
+
+        for(unsigned int shift = 0; shift < 64; shift += 8)
+        {
+            size_t step = state * 256 + ((word >> shift) & 0xFF);
+
+            for(uint32_t i = step_matches[step]; i < step_matches[step + 1]; i++)
+            {
+                report(matches[i].pattern, index + shift + matches[i].end);
+            }
+
+            state = steps[step];
+        }
+    }
+
+    // Rest of the bits
+    for(; index < size; index++)
+    {
+        state = delta[2 * state + bitstring[index]];
+
+        for(size_t i = 0; i < outputs[state].size(); i++)
+        {
+            report(outputs[state][i], index);
+        }
+    }
+}
+
+
+const EncodingRegistry&
+EncodingRegistry::standard(void)
+{
+    static const EncodingRegistry registry = []()
+    {
+        EncodingRegistry encodings;
+        encodings.add(Encoding::iata());
+        encodings.add(Encoding::aba());
+        encodings.add(Encoding::thrift());
+        return encodings;
+    }();
+
+    return registry;
+}
+
+void
+EncodingRegistry::add(const Encoding& encoding)
+{
+    encodings.push_back(encoding);
+
+    // Decoded like an encoding registered before?
+    for(size_t i = 0; i < codes.size(); i++)
+    {
+        Code& code = codes[i];
+
+        if(code.char_length == encoding.char_length &&
+           code.start_sentinel == encoding.start_sentinel &&
+           code.end_sentinel == encoding.end_sentinel &&
+           code.charset_begin == encoding.charset_begin)
+        {
+            code.encodings.push_back(encodings.size() - 1);
+            return;
+        }
+    }
+
+    Code code;
+    code.char_length = encoding.char_length;
+    code.start_sentinel = encoding.start_sentinel;
+    code.end_sentinel = encoding.end_sentinel;
+    code.charset_begin = encoding.charset_begin;
+    code.table = encoding.table;
+    code.encodings.push_back(encodings.size() - 1);
+
+    // Odd parity: number of set bits including the parity bit is odd
+    if(code.table == NULL)
+    {
+        const uint64_t data_mask = (1ULL << (code.char_length - 1)) - 1;
+        code.built.resize(1U << code.char_length);
+        for(unsigned int bits = 0; bits < code.built.size(); bits++)
+        {
+            code.built[bits] = bit_count(bits) % 2 == 1 ?
+                (unsigned char) (code.charset_begin + (bits & data_mask)) : 0;
+        }
+    }
+
+    codes.push_back(code);
+
+    // Start sentinels of all codes, in both directions
+    std::vector<uint64_t> patterns;
+    std::vector<unsigned int> widths;
+    for(size_t i = 0; i < codes.size(); i++)
+    {
+        patterns.push_back(codes[i].start_sentinel);
+        patterns.push_back(bit_reverse(codes[i].start_sentinel, codes[i].char_length));
+        widths.push_back(codes[i].char_length);
+        widths.push_back(codes[i].char_length);
+    }
+
+    automaton.build(patterns, widths);
+}
+
+void
+EncodingRegistry::parse(const BitView& bitstring, std::vector<TrackResult>& tracks,
+                        bool strict, std::vector<TrackResult>* spare) const
+{
+    const size_t count = codes.size();
+
+    // Positions of the sentinels; on the heap only for many codes
+    size_t stack_positions[4 * PARSE_STACK_CODES];
+    std::vector<size_t> heap_positions;
+    size_t* first = stack_positions;
+    if(count > PARSE_STACK_CODES)
+    {
+        heap_positions.resize(4 * count);
+        first = &heap_positions[0];
+    }
+    size_t* last = first + 2 * count;
+
+    // Search all start sentinels at once; the last match of a reversed
+    // sentinel is the first match in the reversed direction
+    automaton.search(bitstring, first, last);
+
+    // Decode candidates; the reversed view does not copy anything
+    for(int reversed = 0; reversed < 2; reversed++)
+    {
+        BitView view = reversed ? BitView(bitstring, ! bitstring.is_reversed()) : bitstring;
+
+        for(size_t i = 0; i < count; i++)
+        {
+            const Code& code = codes[i];
+            size_t start = first[2 * i];
+
+            if(reversed)
+            {
+                start = last[2 * i + 1] == BitView::npos ? BitView::npos :
+                    bitstring.size() - code.char_length - last[2 * i + 1];
+            }
+
+            if(start == BitView::npos)
+                continue;
+
+            tracks.push_back(TrackResult());
+            if(spare != NULL && ! spare->empty())
+            {
+                std::swap(tracks.back(), spare->back());
+                spare->pop_back();
+            }
+
+            TrackResult& track = tracks.back();
+            track.reversed = reversed != 0;
+            track.status = parse_from(code, view, start, track.data);
+
+            if(strict && track.status == PARSE_OK &&
+               ! check_lrc(code, view, start, track.data))
+            {
+                track.status = PARSE_LRC;
+            }
+
+            track.parser = name_of(code, track.status == PARSE_OK ? track.data.size() : 0);
+        }
+    }
+}
+
+ParseStatus
+EncodingRegistry::parse_from(const Code& code, const BitView& bitstring,
+                             size_t start_decode, std::string& result) const
+{
+    const unsigned int char_length = code.char_length;
+    const uint64_t data_mask = (1ULL << (char_length - 1)) - 1;
+    const unsigned char* table = table_of(code);
+
+    // Clear contents of the string
+    result.clear();
+
+    // Move start pointer to the next character past the start sentinel
+    start_decode += char_length;
+
+    // Find end of encoded string at a character boundary
+    size_t end_decode = BitView::npos;
+    for(size_t i = start_decode + char_length;
+        i + char_length <= bitstring.size();
+        i += char_length)
+    {
+        if(bitstring.extract(i, char_length) == code.end_sentinel)
+        {
+            end_decode = i;
+            break;
+        }
+    }
+
+    // If no end sentinel found, cancel processing
+    if(end_decode == BitView::npos)
+    {
+        return PARSE_NO_SENTINEL;
+    }
+
+    // Enter start sentinel; initial condition is LRC of the start sentinel
+    result.push_back(table[code.start_sentinel]);
+    uint64_t lrc = code.start_sentinel;
+
+    // Decoded character for character
+    for(size_t i = start_decode; i < end_decode + char_length; i += char_length)
+    {
+        uint64_t char_bits = bitstring.extract(i, char_length);
+        unsigned char c = table[char_bits];
+
+        if(c == 0)
+        {
+            return PARSE_CHAR_PARITY;
+        }
+
+        result.push_back(c);
+        lrc ^= char_bits & data_mask;
+    }
+
+    // Check for correct LRC
+    if(table[lrc] == 0)
+    {
+        return PARSE_LRC;
+    }
+
+    return PARSE_OK;
+}
+
+bool
+EncodingRegistry::check_lrc(const Code& code, const BitView& bitstring,
+                            size_t start_decode, const std::string& result) const
+{
+    const unsigned int char_length = code.char_length;
+    const uint64_t data_mask = (1ULL << (char_length - 1)) - 1;
+
+    // LRC character follows the end sentinel
+    size_t lrc_index = start_decode + result.size() * char_length;
+    if(lrc_index + char_length > bitstring.size())
+    {
+        return false;
+    }
+
+    // Its data bits are the sum without carry of all data bits
+    uint64_t lrc = 0;
+    for(size_t i = 0; i < result.size(); i++)
+    {
+        lrc ^= (unsigned char) (result[i] - code.charset_begin);
+    }
+
+    uint64_t char_bits = bitstring.extract(lrc_index, char_length);
+
+    return (char_bits & data_mask) == lrc && table_of(code)[char_bits] != 0;
+}
+
+const char*
+EncodingRegistry::name_of(const Code& code, size_t length) const
+{
+    // First encoding the track fits in, LRC included
+    for(size_t i = 0; i < code.encodings.size(); i++)
+    {
+        const Encoding& encoding = encodings[code.encodings[i]];
+
+        if(encoding.max_chars == 0 || length + 1 <= encoding.max_chars)
+            return encoding.name.c_str();
+    }
+
+    return encodings[code.encodings.back()].name.c_str();
+}
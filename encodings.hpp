@@ -0,0 +1,244 @@
+/**
+    encodings.hpp
+
+    Registry of track encodings, decoded at runtime by tables of
+    characters generated at compile time for the standard encodings.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#ifndef ENCODINGS_HPP
+#define ENCODINGS_HPP
+
+#include <array>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <inttypes.h>
+
+#include "bitstring.hpp"
+#include "parser.hpp"
+
+
+// Codes whose sentinel positions are kept on the stack while parsing
+#define PARSE_STACK_CODES 8
+
+
+/**
+    Standard encodings of tracks 1, 2 and 3, fixed at compile time.
+*/
+struct IATAFormat
+{
+    static const char* name(void) { return "IATA"; }
+    static const unsigned int char_length = 7;
+    static constexpr uint64_t start_sentinel = bit_pattern("1010001");
+    static constexpr uint64_t end_sentinel = bit_pattern("1111100");
+    static const unsigned char charset_begin = ' ';
+    static const unsigned int max_chars = 79;
+};
+
+struct ABAFormat
+{
+    static const char* name(void) { return "ABA"; }
+    static const unsigned int char_length = 5;
+    static constexpr uint64_t start_sentinel = bit_pattern("11010");
+    static constexpr uint64_t end_sentinel = bit_pattern("11111");
+    static const unsigned char charset_begin = '0';
+    static const unsigned int max_chars = 40;
+};
+
+struct ThriftFormat
+{
+    static const char* name(void) { return "Thrift"; }
+    static const unsigned int char_length = 5;
+    static constexpr uint64_t start_sentinel = bit_pattern("11010");
+    static constexpr uint64_t end_sentinel = bit_pattern("11111");
+    static const unsigned char charset_begin = '0';
+    static const unsigned int max_chars = 107;
+};
+
+
+/**
+    Table mapping every bit combination of a character (parity included)
+    to the decoded character, or to 0 if the parity does not match.
+*/
+template<unsigned int CharLength, unsigned char CharsetBegin>
+struct CharTable
+{
+    static constexpr unsigned char entry(unsigned int bits)
+    {
+        // Odd parity: number of set bits including the parity bit is odd
+        unsigned int set_bits = 0;
+        for(unsigned int i = 0; i < CharLength; i++)
+        {
+            set_bits += (bits >> i) & 1;
+        }
+
+        unsigned int data = bits & ((1U << (CharLength - 1)) - 1);
+
+        return set_bits % 2 == 1 ? (unsigned char) (CharsetBegin + data) : 0;
+    }
+
+    template<size_t... Bits>
+    static constexpr std::array<unsigned char, sizeof...(Bits)>
+    make(std::index_sequence<Bits...>)
+    {
+        return {{ entry(Bits)... }};
+    }
+
+    static constexpr std::array<unsigned char, 1U << CharLength> table =
+        make(std::make_index_sequence<1U << CharLength>());
+};
+
+template<unsigned int CharLength, unsigned char CharsetBegin>
+constexpr std::array<unsigned char, 1U << CharLength>
+CharTable<CharLength, CharsetBegin>::table;
+
+
+/**
+    Description of a track encoding.
+*/
+struct Encoding
+{
+    std::string name;
+    unsigned int char_length;   // in bits, parity included
+    uint64_t start_sentinel;    // first bit lowest
+    uint64_t end_sentinel;
+    unsigned char charset_begin;    // character encoded by zero
+    unsigned int max_chars;     // Longest track, sentinels and LRC included
+    const unsigned char* table; // CharTable of a format, or NULL
+
+    // Encoding fixed at compile time
+    template<class Format>
+    static Encoding of(void);
+
+    // Standard encodings of tracks 1, 2 and 3
+    static Encoding iata(void) { return of<IATAFormat>(); }
+    static Encoding aba(void) { return of<ABAFormat>(); }
+    static Encoding thrift(void) { return of<ThriftFormat>(); }
+
+    /**
+        Encoding from NAME:BITS:START:END:CHARSET[:MAX], e.g.
+        "ABA:5:11010:11111:0:40"; false if malformed.
+    */
+    static bool parse(const char* spec, Encoding& encoding);
+};
+
+template<class Format>
+Encoding
+Encoding::of(void)
+{
+    Encoding encoding = { Format::name(), Format::char_length, Format::start_sentinel,
+                          Format::end_sentinel, Format::charset_begin, Format::max_chars,
+                          CharTable<Format::char_length, Format::charset_begin>::table.data() };
+    return encoding;
+}
+
+
+/**
+    Aho-Corasick automaton finding several bit patterns in one pass.
+
+    The automaton advances eight bits per table lookup, which also
+    yields the patterns ending within these bits. Apart from reporting
+    matches, the cost of a search does not depend on the number of
+    patterns.
+*/
+class SentinelAutomaton
+{
+public:
+    SentinelAutomaton(void) : pattern_count(0) {  }
+
+    // Patterns as by bit_pattern(); a pattern may be given several times
+    void build(const std::vector<uint64_t>& patterns, const std::vector<unsigned int>& widths);
+
+    /**
+        For every pattern the first and the last index where it starts
+        in the view, or BitView::npos.
+    */
+    void search(const BitView& bitstring, size_t* first, size_t* last) const;
+
+private:
+    // Pattern ending at a bit of a byte
+    struct Match
+    {
+        unsigned int pattern;
+        unsigned int end;   // Index of the bit in the byte
+    };
+
+    size_t pattern_count;
+    std::vector<unsigned int> widths;
+    std::vector<uint32_t> delta;            // Next state per state and bit
+    std::vector<std::vector<unsigned int> > outputs;    // Patterns ending in a state
+    std::vector<uint32_t> steps;            // Next state per state and byte
+    std::vector<uint32_t> step_matches;     // Matches of step i from entry i on
+    std::vector<Match> matches;             // ... up to entry i + 1
+};
+
+
+/**
+    Encodings tried on every swipe.
+
+    Start sentinels of all encodings, in both directions, are searched
+    by a single automaton. Encodings sharing sentinels and character
+    set (e.g. ABA and Thrift) are decoded once; the track is named after
+    the first of them it is short enough for, or else the last one.
+    Encodings fixed at compile time decode characters by their
+    CharTable; tables of others are built when they are added.
+    Results are in the order of the encodings, forward ones first. In
+    strict mode a track is valid only if the LRC character follows it,
+    e.g. to tell a complete track from part of a swipe still in
+    progress.
+*/
+class EncodingRegistry
+{
+public:
+    EncodingRegistry(void) {  }
+
+    // IATA, ABA and Thrift
+    static const EncodingRegistry& standard(void);
+
+    void add(const Encoding& encoding);
+    size_t size(void) const { return encodings.size(); }
+    const Encoding& operator[](size_t index) const { return encodings[index]; }
+
+    /**
+        Append the tracks found; with spare tracks given, these are
+        taken for new tracks first, so that their strings are reused.
+    */
+    void parse(const BitView& bitstring, std::vector<TrackResult>& tracks,
+               bool strict = false, std::vector<TrackResult>* spare = NULL) const;
+
+private:
+    // Encodings decoded the same way
+    struct Code
+    {
+        unsigned int char_length;
+        uint64_t start_sentinel;
+        uint64_t end_sentinel;
+        unsigned char charset_begin;
+        const unsigned char* table;         // Character per bits, 0 on parity error
+        std::vector<unsigned char> built;   // The table unless fixed at compile time
+        std::vector<size_t> encodings;      // Indexes of the encodings
+    };
+
+    const unsigned char* table_of(const Code& code) const
+    {
+        return code.table != NULL ? code.table : &code.built[0];
+    }
+    ParseStatus parse_from(const Code& code, const BitView& bitstring,
+                           size_t start_decode, std::string& result) const;
+    bool check_lrc(const Code& code, const BitView& bitstring, size_t start_decode,
+                   const std::string& result) const;
+    const char* name_of(const Code& code, size_t length) const;
+
+    std::vector<Encoding> encodings;
+    std::vector<Code> codes;
+    SentinelAutomaton automaton;    // Pattern 2 i: start sentinel of code i,
+                                    // pattern 2 i + 1: the same reversed
+};
+
+
+#endif /* ENCODINGS_HPP */
@@ -0,0 +1,120 @@
+/**
+    fileio.cpp
+
+    File access shared by recordings, archives and records.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#include "fileio.hpp"
+
+// Platform-dependent file mapping
+#if defined( __WINDOWS_ASIO__ ) || defined( __WINDOWS_DS__ )
+  #include <windows.h>
+#else // Unix variants
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
+
+MappedFile::MappedFile(void) :
+        mapping(NULL), mapping_size(0)
+#if defined( __WINDOWS_ASIO__ ) || defined( __WINDOWS_DS__ )
+        , file_handle(INVALID_HANDLE_VALUE), mapping_handle(NULL)
+#endif
+{
+}
+
+MappedFile::~MappedFile(void)
+{
+    close();
+}
+
+bool
+MappedFile::open(const char* file_name)
+{
+    close();
+    error.clear();
+
+#if defined( __WINDOWS_ASIO__ ) || defined( __WINDOWS_DS__ )
+    file_handle = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if(file_handle == INVALID_HANDLE_VALUE)
+        return fail(std::string("Could not open ") + file_name);
+
+    LARGE_INTEGER file_size;
+    if(! GetFileSizeEx(file_handle, &file_size))
+        return fail(std::string("Could not get size of ") + file_name);
+
+    mapping_size = (size_t) file_size.QuadPart;
+
+    if(mapping_size > 0)
+    {
+        mapping_handle = CreateFileMapping(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+        if(mapping_handle == NULL)
+            return fail(std::string("Could not map ") + file_name);
+
+        mapping = MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+        if(mapping == NULL)
+            return fail(std::string("Could not map ") + file_name);
+    }
+#else
+    int fd = ::open(file_name, O_RDONLY);
+    if(fd < 0)
+        return fail(std::string("Could not open ") + file_name);
+
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) < 0)
+    {
+        ::close(fd);
+        return fail(std::string("Could not get size of ") + file_name);
+    }
+
+    mapping_size = file_stat.st_size;
+
+    if(mapping_size > 0)
+    {
+        mapping = mmap(NULL, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapping == MAP_FAILED)
+        {
+            mapping = NULL;
+            ::close(fd);
+            return fail(std::string("Could not map ") + file_name);
+        }
+
+        // Read from front to back
+        madvise(mapping, mapping_size, MADV_SEQUENTIAL);
+    }
+
+    // The mapping stays valid without the descriptor
+    ::close(fd);
+#endif
+
+    return true;
+}
+
+void
+MappedFile::close(void)
+{
+#if defined( __WINDOWS_ASIO__ ) || defined( __WINDOWS_DS__ )
+    if(mapping != NULL)
+        UnmapViewOfFile(mapping);
+    if(mapping_handle != NULL)
+        CloseHandle(mapping_handle);
+    if(file_handle != INVALID_HANDLE_VALUE)
+        CloseHandle(file_handle);
+
+    mapping_handle = NULL;
+    file_handle = INVALID_HANDLE_VALUE;
+#else
+    if(mapping != NULL)
+        munmap(mapping, mapping_size);
+#endif
+
+    mapping = NULL;
+    mapping_size = 0;
+}
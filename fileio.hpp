@@ -0,0 +1,74 @@
+/**
+    fileio.hpp
+
+    File access shared by recordings, archives and records.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#ifndef FILEIO_HPP
+#define FILEIO_HPP
+
+#include <string>
+
+#include <inttypes.h>
+
+
+/**
+    Whole file mapped into memory for reading, front to back.
+*/
+class MappedFile
+{
+public:
+    MappedFile(void);
+    ~MappedFile(void);
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const char* file_name);
+    void close(void);
+    const std::string& get_error(void) const { return error; }
+
+    // NULL if the file is empty
+    const unsigned char* data(void) const { return (const unsigned char*) mapping; }
+    size_t size(void) const { return mapping_size; }
+
+private:
+    bool fail(const std::string& message) { error = message; close(); return false; }
+
+    void* mapping;
+    size_t mapping_size;
+#if defined( __WINDOWS_ASIO__ ) || defined( __WINDOWS_DS__ )
+    void* file_handle;
+    void* mapping_handle;
+#endif
+    std::string error;
+};
+
+
+// Little endian integer of the given number of bytes
+inline void
+append_le(std::string& out, uint64_t value, unsigned int bytes)
+{
+    for(unsigned int i = 0; i < bytes; i++)
+    {
+        out.push_back((char) ((value >> (8 * i)) & 0xFF));
+    }
+}
+
+inline uint64_t
+read_le(const unsigned char* p, unsigned int bytes)
+{
+    uint64_t value = 0;
+    for(unsigned int i = 0; i < bytes; i++)
+    {
+        value |= (uint64_t) p[i] << (8 * i);
+    }
+    return value;
+}
+
+
+#endif /* FILEIO_HPP */
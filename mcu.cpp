@@ -20,151 +20,52 @@
 
 #include <map>
 #include <algorithm>
-
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <mutex>
+#include <thread>
+
+#include <cmath>
+#include <csignal>
 #include <cstdlib>
 #include <getopt.h>
 
+#include "threadpool.hpp"
 
-// Platform-dependent sleep routines; taken from RtAudio example
+// Platform-dependent directory listing
 #if defined( __WINDOWS_ASIO__ ) || defined( __WINDOWS_DS__ )
   #include <windows.h>
-  #define SLEEP( milliseconds ) Sleep( (DWORD) milliseconds )
 #else // Unix variants
-  #include <unistd.h>
-  #define SLEEP( milliseconds ) usleep( (unsigned long) (milliseconds * 1000.0) )
+  #include <dirent.h>
+  #include <sys/stat.h>
 #endif
 
 
-void
-MagneticBitstringParser::parse(std::string& bitstring, std::string& result)
-{
-    // Clear contents of the string
-    result.clear();
-
-    // initial condition is LRC of the start sentinel
-    int lrc[char_length];
-
-    // Initialize LRC
-    for(size_t i = 0; i < char_length; i++)
-    {
-        lrc[i] = start_sentinel[i] - '0';
-    }
-
-    // Find start of encoded string
-    size_t start_decode = bitstring.find(start_sentinel);
-
-    // If no start sentinel found, cancel processing
-    if(start_decode == std::string::npos)
-    {
-        return;
-    }
-
-    // Move start pointer to the next character past the start sentinel
-    start_decode += char_length;
-
-    // Set starting point for searching the end sentinel
-    size_t end_decode = start_decode;
-
-    // Find end of encoded string; ensure it's correct position
-    do
-    {
-        end_decode = bitstring.find(end_sentinel, end_decode + 1);
-    }
-    while(end_decode != std::string::npos &&
-          (end_decode - start_decode) % char_length != 0);
-
-    // If no end sentinel found, cancel processing
-    if(end_decode == std::string::npos)
-    {
-        return;
-    }
-
-    // Enter start sentinel
-    result.push_back(decode_char(start_sentinel));
-
-    // Decoded character for character
-    for(size_t i = start_decode; i < end_decode + char_length; i += char_length)
-    {
-        // Extract bits
-        std::string char_bits;
-        copy(bitstring.begin() + i,
-             bitstring.begin() + i + char_length,
-             std::back_inserter(char_bits));
-
-        if(! check_parity(char_bits))
-        {
-            // Parity mismatch
-            std::cerr << "Character parity mismatch!" << std::endl;
-            return;
-        }
+// Set on SIGINT or SIGTERM; decoding stops, so that results and the
+// archive are completed
+static volatile sig_atomic_t interrupted = 0;
 
-        // Decode bits
-        result.push_back(decode_char(char_bits));
-
-        // Update LRC
-        for(size_t i = 0; i < parity_bit; i++)
-        {
-            lrc[i] ^= char_bits[i] == '1' ? 1 : 0;
-        }
-    }
-
-    // Check for correct LRC
-    std::string lrc_bits;
-    for(size_t i = 0; i < char_length; i++)
-    {
-        lrc_bits.push_back('0' + lrc[i]);
-    }
-
-    if(! check_parity(lrc_bits))
-    {
-        // Parity mismatch
-        std::cerr << "Information parity mismatch!" << std::endl;
-        return;
-    }
-}
-
-unsigned char
-MagneticBitstringParser::decode_char(std::string& bits)
-{
-    unsigned char c = 48; // = '0'
-
-    for(size_t i = 0, value = 1;
-        i < parity_bit;
-        i++, value *= 2)
-    {
-        c += bits[i] == '1' ? value : 0;
-    }
-
-    return c;
-}
-
-bool
-MagneticBitstringParser::check_parity(std::string& bits)
+static void
+interrupt(int signal_number)
 {
-    unsigned int parity = 0;
-
-    for(size_t i = 0; i < parity_bit; i++)
-    {
-        if(bits[i] == '1')
-        {
-            parity++;
-        }
-    }
-
-    if('0' + parity % 2 == (unsigned int) bits[parity_bit])
-    {
-        // Parity mismatch
-        return false;
-    }
+    interrupted = 1;
 
-    return true;
+    // Another signal terminates at once
+    signal(signal_number, SIG_DFL);
 }
 
 
 MCU::MCU(int argc, char** argv) :
-        buffer_index(0), silence_thres(SILENCE_THRES),
+        silence_thres(SILENCE_THRES),
         auto_thres(AUTO_THRES), max_level(false), verbose(true),
-        list_input_devices(false), device_number(0)
+        list_input_devices(false), continuous(false), device_numbers(1, 0), channels(1),
+        multitrack(false), encodings(EncodingRegistry::standard()),
+        raw_sample_rate(RAW_SAMPLE_RATE), target_rate(TARGET_RATE), jobs(0), recover(false),
+        output_format(OUTPUT_TEXT), buffer_frames(BUFFER_FRAMES), periods(0),
+        low_latency(false), realtime_priority(0), calibrate_minutes(0)
 {
     // Parse command line arguments
     // Getopt variables
@@ -172,20 +73,41 @@ MCU::MCU(int argc, char** argv) :
     static struct option long_options[] =
     {
         {"auto-thres",   0, 0, 'a'},
+        {"archive",      1, 0, 'A'},
+        {"batch",        1, 0, 'b'},
+        {"buffer",       1, 0, 'B'},
+        {"continuous",   0, 0, 'c'},
+        {"capture-cpus", 1, 0, 'C'},
         {"device",       1, 0, 'd'},
+        {"decode-cpus",  1, 0, 'D'},
+        {"encoding",     1, 0, 'e'},
+        {"file",         1, 0, 'f'},
+        {"target-rate",  1, 0, 'F'},
+        {"calibrate",    1, 0, 'K'},
         {"list-devices", 0, 0, 'l'},
+        {"low-latency",  0, 0, 'L'},
         {"help",         0, 0, 'h'},
+        {"jobs",         1, 0, 'j'},
         {"max-level",    0, 0, 'm'},
+        {"channels",     1, 0, 'n'},
+        {"output",       1, 0, 'o'},
+        {"periods",      1, 0, 'p'},
+        {"replay",       1, 0, 'P'},
+        {"sample-rate",  1, 0, 'r'},
+        {"recover",      0, 0, 'R'},
         {"silent",       0, 0, 's'},
+        {"stats",        1, 0, 'S'},
         {"threshold",    1, 0, 't'},
+        {"tracks",       0, 0, 'T'},
         {"version",      0, 0, 'v'},
+        {"realtime",     1, 0, 'X'},
         { 0,             0, 0,  0 }
     };
 
     // Process command line arguments
     while(true)
     {
-        ch = getopt_long(argc, argv, "a:d:lhmst:v", long_options, &option_index);
+        ch = getopt_long(argc, argv, "a:A:b:B:cC:d:D:e:f:F:K:lLhj:mn:o:p:P:r:RsS:t:TvX:", long_options, &option_index);
 
         if(ch == -1)
             break;
@@ -197,9 +119,81 @@ MCU::MCU(int argc, char** argv) :
                 auto_thres = atoi(optarg);
                 break;
 
-            // Device (number)
+            // Archive of the swipes
+            case 'A':
+                archive_file = optarg;
+                break;
+
+            // Batch of recordings
+            case 'b':
+                batch_path = optarg;
+                break;
+
+            // Frames per buffer of the audio input
+            case 'B':
+                buffer_frames = atoi(optarg);
+                break;
+
+            // Continuous service mode
+            case 'c':
+                continuous = true;
+                break;
+
+            // CPUs of the callback threads
+            case 'C':
+                if(! parse_numbers(optarg, capture_cpus))
+                {
+                    print_help();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            // Devices (numbers)
             case 'd':
-                device_number = atoi(optarg);
+                if(! parse_devices(optarg))
+                {
+                    print_help();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            // CPUs of the decoding threads
+            case 'D':
+                if(! parse_numbers(optarg, decode_cpus))
+                {
+                    print_help();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            // User-defined encoding
+            case 'e':
+            {
+                Encoding encoding;
+                if(! Encoding::parse(optarg, encoding))
+                {
+                    std::cerr << "Error: Invalid encoding " << optarg << "!" << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+
+                user_encodings.push_back(encoding);
+                encodings.add(encoding);
+                break;
+            }
+
+            // Decode recorded file
+            case 'f':
+                input_file = optarg;
+                break;
+
+            // Sample rate to decimate live input to
+            case 'F':
+                target_rate = atoi(optarg);
+                break;
+
+            // Find the smallest buffer sustaining the input
+            case 'K':
+                calibrate_minutes = atof(optarg);
                 break;
 
             // List devices
@@ -207,34 +201,93 @@ MCU::MCU(int argc, char** argv) :
                 list_input_devices = true;
                 break;
 
+            // Lowest latency the audio API offers
+            case 'L':
+                low_latency = true;
+                break;
+
             // Help
             case 'h':
                 print_help();
                 exit(EXIT_SUCCESS);
                 break;
 
-            // Maximal level
+            // Number of decoding threads
+            case 'j':
+                jobs = atoi(optarg);
+                break;
+
+            // Level meter
             case 'm':
                 max_level = true;
                 break;
 
+            // Readers per device
+            case 'n':
+                channels = atoi(optarg);
+                break;
+
+            // Format of the results
+            case 'o':
+                if(! parse_output_format(optarg, output_format))
+                {
+                    print_help();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            // Buffers of the audio device
+            case 'p':
+                periods = atoi(optarg);
+                break;
+
+            // Archive to replay
+            case 'P':
+                replay_file = optarg;
+                break;
+
+            // Sample rate of raw files
+            case 'r':
+                raw_sample_rate = atoi(optarg);
+                break;
+
+            // Re-decode failed swipes
+            case 'R':
+                recover = true;
+                break;
+
             // Silent
             case 's':
                 verbose = false;
                 break;
 
+            // Metrics file
+            case 'S':
+                stats_file = optarg;
+                break;
+
             // Threshold
             case 't':
                 auto_thres = 0;
                 silence_thres = atoi(optarg);
                 break;
 
+            // Tracks of a multi-head reader
+            case 'T':
+                multitrack = true;
+                break;
+
             // Version
             case 'v':
                 print_version();
                 exit(EXIT_SUCCESS);
                 break;
 
+            // Realtime scheduling of the callback threads
+            case 'X':
+                realtime_priority = atoi(optarg);
+                break;
+
             // Unknown options
             default:
                 print_help();
@@ -246,154 +299,1102 @@ MCU::MCU(int argc, char** argv) :
 }
 
 void
-MCU::run(RtAudioCallback input_function, std::vector<sample_t>* b)
+MCU::run(RtAudioCallback input_function, LiveInput* b)
+{
+    // Save reference to the buffer
+    buffer = b;
+
+    // Print version
+    if(verbose)
+    {
+        print_version();
+        std::cerr << std::endl;
+    }
+
+    // Write timings of the pipeline periodically if requested
+    if(! stats_file.empty())
+    {
+        buffer->measured = true;
+        buffer->metrics_writer.reset(new MetricsWriter(buffer->metrics, stats_file));
+    }
+
+    // Machine-readable results are written by a thread of their own
+    if(output_format != OUTPUT_TEXT)
+    {
+        bool live = replay_file.empty() && input_file.empty() && batch_path.empty();
+        buffer->record_writer.reset(new RecordWriter(output_format, stdout, live));
+    }
+
+    // Threads re-decoding failed swipes; batches use their own
+    if(recover && batch_path.empty())
+    {
+        recovery_pool.reset(new ThreadPool(jobs));
+    }
+
+    // Append the samples of every swipe to the archive
+    if(! archive_file.empty())
+    {
+        buffer->archive.reset(new ArchiveWriter());
+        if(! buffer->archive->open(archive_file.c_str()))
+        {
+            std::cerr << "Error: " << buffer->archive->get_error() << "!" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Stop decoding cleanly when interrupted
+    signal(SIGINT, interrupt);
+    signal(SIGTERM, interrupt);
+
+    // Decode archived swipes instead of audio input if requested
+    if(! replay_file.empty())
+    {
+        decode_archive(replay_file.c_str());
+        return;
+    }
+
+    // Decode recordings instead of audio input if requested
+    if(! input_file.empty())
+    {
+        decode_file(input_file.c_str());
+        return;
+    }
+
+    if(! batch_path.empty())
+    {
+        decode_batch(batch_path.c_str());
+        return;
+    }
+
+    // Make RtAudio part verbose too
+    if(verbose)
+        adc.showWarnings(true);
+
+    // If no sound devices found, exit
+    if(adc.getDeviceCount() < 1)
+    {
+        std::cerr << "No audio devices found!" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // Get list of device
+    list_devices(devices, device_indexes);
+
+    // If requested, print list of devices and exit
+    if(list_input_devices)
+    {
+        print_devices(devices);
+        exit(EXIT_SUCCESS);
+    }
+
+    // Sanity check for silence threshold
+    if(silence_thres == 0)
+    {
+        std::cerr << "Error: Invalid silence threshold!" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // Find the smallest buffer sustaining the input if requested
+    if(calibrate_minutes > 0)
+    {
+        calibrate_buffer(input_function);
+        exit(EXIT_SUCCESS);
+    }
+
+    // Open and start audio streams of all readers
+    open_readers(input_function);
+
+    // Decode swipes of every reader
+    decode_readers();
+
+    // Stop and close audio streams
+    cleanup();
+
+}
+
+bool
+MCU::parse_devices(const char* list)
+{
+    if(! parse_numbers(list, device_numbers))
+        return false;
+
+    // Every device is opened once only
+    std::vector<int> sorted(device_numbers);
+    std::sort(sorted.begin(), sorted.end());
+
+    return std::adjacent_find(sorted.begin(), sorted.end()) == sorted.end();
+}
+
+bool
+MCU::parse_numbers(const char* list, std::vector<int>& numbers)
+{
+    numbers.clear();
+
+    // Numbers separated by commas
+    while(true)
+    {
+        char* end;
+        long number = strtol(list, &end, 10);
+
+        if(end == list || number < 0)
+            return false;
+
+        numbers.push_back((int) number);
+
+        if(*end == '\0')
+            return true;
+        if(*end != ',')
+            return false;
+
+        list = end + 1;
+    }
+}
+
+void
+MCU::open_readers(RtAudioCallback input_function)
+{
+    // Tracks of a multi-head reader; two unless told otherwise
+    if(multitrack && channels == 1)
+    {
+        channels = 2;
+    }
+
+    // Sanity check for number of channels
+    if(channels == 0 || (multitrack && channels > MAX_TRACKS))
+    {
+        std::cerr << "Error: Invalid number of channels!" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    for(size_t i = 0; i < device_numbers.size(); i++)
+    {
+        if(device_numbers[i] >= (int) devices.size())
+        {
+            std::cerr << "Error: No input device " << device_numbers[i] << "!" << std::endl;
+            cleanup();
+            exit(EXIT_FAILURE);
+        }
+
+        const RtAudio::DeviceInfo& info = devices[device_numbers[i]];
+        if(info.inputChannels < channels)
+        {
+            std::cerr << "Error: " << info.name << " has only "
+                      << info.inputChannels << " input channels!" << std::endl;
+            cleanup();
+            exit(EXIT_FAILURE);
+        }
+
+        // Specify parameters of the audio stream
+        unsigned int frames = buffer_frames;
+        unsigned int device_index = device_indexes[device_numbers[i]];
+        unsigned int decimation;
+        unsigned int sample_rate = capture_sample_rate(device_index, decimation);
+        if(verbose && decimation > 1)
+        {
+            std::cerr << "Device " << device_numbers[i] << ": " << sample_rate
+                      << " Hz, decimated to " << sample_rate / decimation << " Hz" << std::endl;
+        }
+
+        RtAudio::StreamParameters input_params;
+        input_params.deviceId = device_index;
+        input_params.nChannels = channels;
+        input_params.firstChannel = 0;
+
+        // Channels one after another, so every reader gets a plain block
+        RtAudio::StreamOptions options;
+        options.flags = RTAUDIO_NONINTERLEAVED;
+        options.numberOfBuffers = periods;
+
+        // Shorter queues and a realtime callback thread, if requested
+        if(low_latency)
+        {
+            options.flags |= RTAUDIO_MINIMIZE_LATENCY;
+        }
+
+        if(realtime_priority > 0)
+        {
+            options.flags |= RTAUDIO_SCHEDULE_REALTIME;
+            options.priority = realtime_priority;
+        }
+
+        // A reader per channel
+        StreamInput* stream = new StreamInput();
+        buffer->streams.push_back(std::unique_ptr<StreamInput>(stream));
+        stream->name = std::to_string(device_numbers[i]);
+        stream->sample_rate = sample_rate;
+        stream->metrics = buffer->measured ? &buffer->metrics : NULL;
+        stream->calibrating = calibrate_minutes > 0;
+        if(! capture_cpus.empty())
+            stream->cpu = capture_cpus[i % capture_cpus.size()];
+
+        for(unsigned int channel = 0; channel < channels; channel++)
+        {
+            ReaderInput* reader = new ReaderInput(RING_BUFFER_SIZE, decimation);
+            buffer->readers.push_back(std::unique_ptr<ReaderInput>(reader));
+            reader->sample_rate = sample_rate / decimation;
+            reader->name = std::to_string(device_numbers[i]) + ":" + std::to_string(channel);
+            stream->readers.push_back(reader);
+        }
+
+        // Open and start audio stream; every device has its own
+        adcs.push_back(std::unique_ptr<RtAudio>(new RtAudio()));
+        try
+        {
+            adcs.back()->openStream(NULL, &input_params, RTAUDIO_SINT16,
+                                    sample_rate, &frames, input_function,
+                                    stream, &options);
+            adcs.back()->startStream();
+        }
+        catch(RtAudioError& e)
+        {
+            std::cerr << std::endl << e.getMessage() << std::endl;
+            cleanup();
+            exit(EXIT_FAILURE);
+        }
+
+        // The device may choose another buffer size
+        stream->buffer_frames = frames;
+        if(verbose)
+        {
+            std::cerr << "Device " << device_numbers[i] << ": " << frames
+                      << " frames per buffer (" << 1000.0 * frames / sample_rate
+                      << " ms)" << std::endl;
+        }
+    }
+}
+
+void
+MCU::close_readers(void)
+{
+    cleanup();
+
+    adcs.clear();
+    buffer->streams.clear();
+    buffer->readers.clear();
+}
+
+void
+MCU::calibrate_buffer(RtAudioCallback input_function)
+{
+    const std::chrono::duration<double> run_time(calibrate_minutes * 60);
+
+    // Decoders keep running until the end of each run
+    continuous = true;
+
+    std::cout << "Calibrating; every buffer size runs " << calibrate_minutes
+              << " minutes unless input is lost..." << std::endl;
+
+    for(unsigned int frames = CALIBRATE_MIN_FRAMES; frames <= CALIBRATE_MAX_FRAMES; frames *= 2)
+    {
+        buffer_frames = frames;
+        open_readers(input_function);
+
+        // End the run in time; an overflow ends it at once
+        std::mutex run_mutex;
+        std::condition_variable run_done;
+        bool done = false;
+
+        std::thread timer([&]()
+        {
+            std::unique_lock<std::mutex> lock(run_mutex);
+            run_done.wait_for(lock, run_time, [&]() { return done; });
+
+            for(size_t i = 0; i < buffer->readers.size(); i++)
+            {
+                buffer->readers[i]->ring.close();
+            }
+        });
+
+        decode_readers();
+
+        {
+            std::lock_guard<std::mutex> lock(run_mutex);
+            done = true;
+        }
+
+        run_done.notify_all();
+        timer.join();
+
+        if(interrupted)
+        {
+            close_readers();
+            exit(EXIT_FAILURE);
+        }
+
+        // Largest buffer granted by the devices
+        bool overflowed = false;
+        unsigned int granted = 0;
+        unsigned int sample_rate = 0;
+        for(size_t i = 0; i < buffer->streams.size(); i++)
+        {
+            overflowed = overflowed || buffer->streams[i]->overflows > 0;
+
+            if(buffer->streams[i]->buffer_frames > granted)
+            {
+                granted = buffer->streams[i]->buffer_frames;
+                sample_rate = buffer->streams[i]->sample_rate;
+            }
+        }
+
+        close_readers();
+
+        std::cout << granted << " frames per buffer: "
+                  << (overflowed ? "input lost" : "sustained") << std::endl;
+
+        if(! overflowed)
+        {
+            std::cout << "Smallest sustained buffer: " << granted << " frames ("
+                      << 1000.0 * granted / sample_rate << " ms); use -B " << granted
+                      << std::endl;
+            return;
+        }
+
+        // Devices with a fixed minimum grant larger buffers anyway
+        if(granted > frames)
+            frames = granted;
+    }
+
+    std::cerr << "Error: No buffer of up to " << CALIBRATE_MAX_FRAMES
+              << " frames sustained the input!" << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+void
+MCU::decode_readers(void)
+{
+    const size_t count = buffer->readers.size();
+    std::atomic<bool> failed(false);
+
+    // Decoders still running; the main thread watches the input meanwhile
+    std::mutex running_mutex;
+    std::condition_variable decoder_done;
+    size_t running = count;
+
+    // In multitrack mode the channels of a device are the tracks of
+    // one reader; their swipes are collected into cards
+    std::vector<std::unique_ptr<SwipeCollector> > collectors;
+    std::vector<EncodingRegistry> tracks_encodings;
+    std::vector<StreamInput*> reader_streams;
+    std::vector<unsigned int> reader_tracks;
+    for(size_t i = 0; i < buffer->streams.size(); i++)
+    {
+        StreamInput* stream = buffer->streams[i].get();
+        std::vector<const SampleRing*> rings;
+
+        for(unsigned int track = 0; track < stream->readers.size(); track++)
+        {
+            rings.push_back(&stream->readers[track]->ring);
+            reader_streams.push_back(stream);
+            reader_tracks.push_back(track);
+        }
+
+        if(multitrack && tracks_encodings.empty())
+        {
+            // Encodings of the track, and those of the user
+            for(unsigned int track = 0; track < channels; track++)
+            {
+                tracks_encodings.push_back(track_encodings(track + 1));
+
+                for(size_t j = 0; j < user_encodings.size(); j++)
+                {
+                    tracks_encodings.back().add(user_encodings[j]);
+                }
+            }
+        }
+
+        if(multitrack)
+        {
+            size_t window = (stream->readers[0]->sample_rate * END_LENGTH) / 1000;
+            collectors.push_back(std::unique_ptr<SwipeCollector>(new SwipeCollector(rings, window)));
+        }
+    }
+
+    // Decode swipes; in continuous mode keep the streams open forever.
+    // Live input is decoded while the card is still moving. Each reader
+    // (or track) has a thread of its own, which sleeps while it is
+    // silent, so the tracks of a card are decoded concurrently
+    auto decode = [&](size_t index)
+    {
+        ReaderInput& reader = *buffer->readers[index];
+        StreamInput& stream = *reader_streams[index];
+        const unsigned int track = reader_tracks[index];
+        SwipeCollector* collector = NULL;
+        std::string name = count > 1 ? reader.name : "";
+
+        // Keep the decoder of the reader on its CPU
+        if(! decode_cpus.empty())
+        {
+            int cpu = decode_cpus[index % decode_cpus.size()];
+            if(! pin_thread(cpu))
+            {
+                std::lock_guard<std::mutex> lock(output_mutex);
+                std::cerr << "Warning: Could not bind decoder of reader " << reader.name
+                          << " to CPU " << cpu << "!" << std::endl;
+            }
+        }
+
+        SwipeDecoder decoder(silence_thres, auto_thres);
+        decoder.set_streaming(true);
+        decoder.set_stats(&reader.stats);
+        decoder.set_encodings(encodings);
+        decoder.set_recovery(recovery_pool.get());
+        decoder.set_archive(buffer->archive.get(), reader.name);
+        if(buffer->measured)
+            decoder.set_metrics(&buffer->metrics);
+
+        // Only the encodings of the track
+        if(multitrack)
+        {
+            collector = collectors[index / channels].get();
+            name = buffer->streams.size() > 1 ? stream.name : "";
+            decoder.set_encodings(tracks_encodings[track]);
+        }
+
+        // Reused by every swipe of the reader
+        SwipeResult result;
+        MultiTrackResult card;
+
+        do
+        {
+            if(collector != NULL)
+            {
+                if(! decode_track(decoder, reader, track, *collector, result, card, name,
+                                  failed))
+                    break;
+            }
+            else if(! decode_swipe(decoder, reader.ring, reader.sample_rate, result, name) &&
+                    ! continuous)
+            {
+                failed = true;
+            }
+        }
+        while(continuous && ! reader.ring.is_closed());
+
+        // A single card is read; stop the other tracks waiting for one
+        if(collector != NULL && ! continuous)
+        {
+            if(collector->card_count() == 0)
+                failed = true;
+
+            for(size_t i = 0; i < stream.readers.size(); i++)
+            {
+                stream.readers[i]->ring.close();
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(running_mutex);
+            running--;
+        }
+
+        decoder_done.notify_one();
+    };
+
+    ThreadPool pool((unsigned int) count);
+    for(size_t i = 0; i < count; i++)
+    {
+        pool.submit(std::bind(decode, i));
+    }
+
+    // Show the levels while decoding if requested
+    std::atomic<bool> decoded(false);
+    std::thread meter;
+    if(max_level)
+        meter = std::thread(&MCU::print_levels, this, std::cref(decoded));
+
+    // Watch the input until all decoders have finished
+    {
+        std::unique_lock<std::mutex> lock(running_mutex);
+        while(! decoder_done.wait_for(lock, std::chrono::milliseconds(WATCH_INTERVAL),
+                                      [&]() { return running == 0; }))
+        {
+            lock.unlock();
+            watch_input();
+            lock.lock();
+        }
+    }
+
+    pool.wait();
+    watch_input();
+
+    if(meter.joinable())
+    {
+        decoded = true;
+        meter.join();
+    }
+
+    if(failed && ! continuous)
+    {
+        cleanup();
+        exit(EXIT_FAILURE);
+    }
+}
+
+bool
+MCU::decode_track(SwipeDecoder& decoder, ReaderInput& reader, unsigned int track,
+                  SwipeCollector& collector, SwipeResult& result,
+                  MultiTrackResult& card, const std::string& device,
+                  std::atomic<bool>& failed)
+{
+    // Wait for a sample
+    if(verbose)
+    {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        std::cerr << "Waiting for sample on track " << track + 1
+                  << (device.empty() ? "" : " of reader ") << device << "..." << std::endl;
+    }
+
+    // Get samples; stop at the end of input
+    if(! decoder.find_swipe(reader.ring, reader.sample_rate))
+    {
+        return false;
+    }
+
+    // Decode the track while the other tracks are decoded too
+    collector.begin_swipe(track);
+
+    decoder.decode_swipe(reader.ring, result);
+
+    collector.add_swipe(track, decoder.get_swipe_start(), result);
+
+    // Print every card complete by now
+    while(collector.next_card(card))
+    {
+        std::lock_guard<std::mutex> lock(output_mutex);
+
+        if(! print_card(card, device))
+        {
+            failed = true;
+        }
+    }
+
+    return true;
+}
+
+void
+MCU::decode_file(const char* file_name)
+{
+    SoundFile file;
+
+    if(! file.open(file_name, raw_sample_rate))
+    {
+        std::cerr << "Error: " << file.get_error() << "!" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // Sanity check for silence threshold
+    if(silence_thres == 0)
+    {
+        std::cerr << "Error: Invalid silence threshold!" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // Decode every swipe in the recording
+    SwipeDecoder decoder(silence_thres, auto_thres);
+    decoder.set_encodings(encodings);
+    decoder.set_recovery(recovery_pool.get());
+    decoder.set_archive(buffer->archive.get(), file_name);
+    if(buffer->measured)
+        decoder.set_metrics(&buffer->metrics);
+    SwipeResult result;
+    bool decoded = false;
+    while(! interrupted && decoder.get_position() < file.size())
+    {
+        if(decode_swipe(decoder, file, file.get_sample_rate(), result))
+        {
+            decoded = true;
+        }
+    }
+
+    if(! decoded)
+    {
+        exit(EXIT_FAILURE);
+    }
+}
+
+void
+MCU::decode_batch(const char* path)
+{
+    // Get recordings to decode
+    std::vector<std::string> files;
+    if(! list_batch(path, files))
+    {
+        std::cerr << "Error: Could not read " << path << "!" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // Sanity check for silence threshold
+    if(silence_thres == 0)
+    {
+        std::cerr << "Error: Invalid silence threshold!" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // Results of one recording
+    struct FileResult
+    {
+        bool done;
+        std::string error;
+        std::vector<SwipeResult> swipes;
+        std::vector<uint64_t> latencies;    // Of decoding, in nanoseconds
+    };
+
+    ThreadPool pool(jobs);
+    std::vector<SwipeDecoder> decoders(pool.size(), SwipeDecoder(silence_thres, auto_thres));
+    for(size_t i = 0; i < decoders.size(); i++)
+    {
+        decoders[i].set_encodings(encodings);
+        if(recover)
+            decoders[i].set_recovery(&pool);
+        if(buffer->measured)
+            decoders[i].set_metrics(&buffer->metrics);
+    }
+    std::vector<FileResult> results(files.size());
+    std::mutex results_mutex;
+    std::condition_variable result_done;
+
+    // Decode one recording with the decoder of the worker
+    auto decode = [&](size_t index, unsigned int worker)
+    {
+        SwipeDecoder& decoder = decoders[worker];
+        FileResult& result = results[index];
+        SoundFile file;
+
+        if(file.open(files[index].c_str(), raw_sample_rate))
+        {
+            decoder.reset();
+            decoder.set_archive(buffer->archive.get(), files[index]);
+            while(! interrupted && decoder.find_swipe(file, file.get_sample_rate()))
+            {
+                uint64_t start = monotonic_ns();
+
+                result.swipes.push_back(SwipeResult());
+                decoder.decode_swipe(file, result.swipes.back());
+                result.latencies.push_back(monotonic_ns() - start);
+            }
+        }
+        else
+        {
+            result.error = file.get_error();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(results_mutex);
+            result.done = true;
+        }
+
+        result_done.notify_all();
+    };
+
+    // Keep a bounded number of recordings in flight
+    const size_t window = 64 * pool.size();
+    size_t submitted = 0;
+    int failures = 0;
+
+    for(size_t i = 0; i < files.size(); i++)
+    {
+        for(; submitted < files.size() && submitted < i + window; submitted++)
+        {
+            results[submitted].done = false;
+            pool.submit(std::bind(decode, submitted, std::placeholders::_1));
+        }
+
+        // Print results in input order
+        {
+            std::unique_lock<std::mutex> lock(results_mutex);
+            while(! results[i].done)
+            {
+                result_done.wait(lock);
+            }
+        }
+
+        FileResult& result = results[i];
+        bool decoded = false;
+
+        if(! buffer->record_writer)
+        {
+            std::cout << "File: " << files[i] << std::endl;
+        }
+
+        if(! result.error.empty())
+        {
+            std::cerr << "Error: " << result.error << "!" << std::endl;
+        }
+
+        for(size_t j = 0; j < result.swipes.size(); j++)
+        {
+            if(buffer->record_writer)
+                buffer->record_writer->write(files[i], 0, result.swipes[j], result.latencies[j]);
+            else
+                print_result(result.swipes[j]);
+
+            decoded = decoded || result.swipes[j].bits_found;
+        }
+
+        if(! decoded)
+        {
+            failures++;
+        }
+
+        // Free memory of printed results
+        std::vector<SwipeResult>().swap(result.swipes);
+        std::vector<uint64_t>().swap(result.latencies);
+    }
+
+    pool.wait();
+
+    if(failures > 0)
+    {
+        std::cerr << failures << " of " << files.size()
+                  << " recordings could not be decoded" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+void
+MCU::decode_archive(const char* file_name)
 {
-    // Save reference to the buffer
-    buffer = b;
+    ArchiveReader archive;
 
-    // Print version
-    if(verbose)
+    if(! archive.open(file_name))
     {
-        print_version();
-        std::cerr << std::endl;
+        std::cerr << "Error: " << archive.get_error() << "!" << std::endl;
+        exit(EXIT_FAILURE);
     }
 
-    // Make RtAudio part verbose too
-    if(verbose)
-        adc.showWarnings(true);
+    if(archive.is_scanned())
+    {
+        std::cerr << "Warning: Index of " << file_name << " missing, "
+                  << archive.size() << " swipes recovered" << std::endl;
+    }
 
-    // If no sound devices found, exit
-    if(adc.getDeviceCount() < 1)
+    // Sanity check for silence threshold
+    if(silence_thres == 0)
     {
-        std::cerr << "No audio devices found!" << std::endl;
+        std::cerr << "Error: Invalid silence threshold!" << std::endl;
         exit(EXIT_FAILURE);
     }
 
-    // Get list of device
-    list_devices(devices, device_indexes);
+    // Decode every swipe with the current settings
+    SwipeDecoder decoder(silence_thres, auto_thres);
+    decoder.set_encodings(encodings);
+    decoder.set_recovery(recovery_pool.get());
+    if(buffer->measured)
+        decoder.set_metrics(&buffer->metrics);
 
-    // If requested, print list of devices and exit
-    if(list_input_devices)
+    // Reused by every swipe
+    std::vector<sample_t> samples;
+    SwipeResult result;
+
+    bool decoded = false;
+    size_t changed = 0;
+    double duration = 0;
+    std::chrono::steady_clock::time_point replay_start = std::chrono::steady_clock::now();
+
+    for(size_t i = 0; i < archive.size(); i++)
     {
-        print_devices(devices);
-        exit(EXIT_SUCCESS);
+        const ArchiveEntry& entry = archive.entry(i);
+
+        if(! archive.samples(i, samples))
+        {
+            std::cerr << "Error: Swipe " << i + 1 << " of " << file_name << " is corrupt!" << std::endl;
+            continue;
+        }
+
+        if(entry.sample_rate > 0)
+            duration += (double) samples.size() / entry.sample_rate;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool bits_found = decoder.decode_segment(
+            SampleSegment(SampleSpan(samples.data(), samples.size())), result);
+        std::chrono::steady_clock::duration latency = std::chrono::steady_clock::now() - start;
+
+        decoded = decoded || bits_found;
+
+        if(archive_outcome(result) != entry.outcome)
+            changed++;
+
+        if(buffer->record_writer)
+        {
+            buffer->record_writer->write(entry.source, 0, result,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count());
+            continue;
+        }
+
+        if(! entry.source.empty())
+        {
+            std::cout << "Source: " << entry.source << std::endl;
+        }
+
+        print_result(result);
     }
 
-    // Specify parameters of the audio stream
-    unsigned int buffer_frames = 512;
-    unsigned int device_index = device_indexes[device_number];
-    unsigned int sample_rate = 44100; // Default value if nothing else found
-    sample_rate = greatest_sample_rate(device_index);
-    RtAudio::StreamParameters input_params;
-    input_params.deviceId = device_index;
-    input_params.nChannels = 1;
-    input_params.firstChannel = 0;
+    // Changed settings may decode swipes differently
+    if(changed > 0)
+    {
+        std::cerr << changed << " of " << archive.size()
+                  << " swipes decoded differently than recorded" << std::endl;
+    }
 
-    // Open and start audio stream
-    try
+    // Print how much faster than real time the swipes were replayed
+    if(verbose)
     {
-        adc.openStream(NULL, &input_params, RTAUDIO_SINT16,
-                       sample_rate, &buffer_frames, input_function, NULL);
-        adc.startStream();
+        double elapsed = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - replay_start).count();
+
+        std::cerr << "Replayed " << archive.size() << " swipes (" << duration
+                  << " s of input) in " << elapsed << " s" << std::endl;
     }
-    catch(RtAudioError& e)
+
+    if(! decoded)
     {
-        std::cerr << std::endl << e.getMessage() << std::endl;
-        cleanup();
+        exit(EXIT_FAILURE);
     }
+}
 
-    // If calculating maximal level is requested, do so and exit
-    if(max_level)
+bool
+MCU::list_batch(const char* path, std::vector<std::string>& files)
+{
+#if defined( __WINDOWS_ASIO__ ) || defined( __WINDOWS_DS__ )
+    DWORD attributes = GetFileAttributesA(path);
+    if(attributes == INVALID_FILE_ATTRIBUTES)
+        return false;
+
+    // All files of a directory, sorted by name
+    if(attributes & FILE_ATTRIBUTE_DIRECTORY)
     {
-        print_max_level(sample_rate);
-        cleanup();
-        exit(EXIT_SUCCESS);
+        WIN32_FIND_DATAA entry;
+        HANDLE dir = FindFirstFileA((std::string(path) + "\\*").c_str(), &entry);
+        if(dir == INVALID_HANDLE_VALUE)
+            return false;
+
+        do
+        {
+            if(! (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+                files.push_back(std::string(path) + "\\" + entry.cFileName);
+        }
+        while(FindNextFileA(dir, &entry));
+
+        FindClose(dir);
+        std::sort(files.begin(), files.end());
+        return true;
     }
+#else
+    struct stat path_stat;
+    if(stat(path, &path_stat) < 0)
+        return false;
 
-    // Sanity check for silence threshold
-    if(silence_thres == 0)
+    // All regular files of a directory, sorted by name
+    if(S_ISDIR(path_stat.st_mode))
     {
-        std::cerr << "Error: Invalid silence threshold!" << std::endl;
-        cleanup();
-        exit(EXIT_FAILURE);
+        DIR* dir = opendir(path);
+        if(dir == NULL)
+            return false;
+
+        while(struct dirent* entry = readdir(dir))
+        {
+            std::string file_name = std::string(path) + "/" + entry->d_name;
+            struct stat file_stat;
+
+            if(stat(file_name.c_str(), &file_stat) == 0 && S_ISREG(file_stat.st_mode))
+                files.push_back(file_name);
+        }
+
+        closedir(dir);
+        std::sort(files.begin(), files.end());
+        return true;
+    }
+#endif
+
+    // List of files, one per line
+    std::ifstream list(path);
+    if(! list)
+        return false;
+
+    std::string line;
+    while(std::getline(list, line))
+    {
+        // Strip line ends of files written on another platform
+        if(! line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+
+        if(! line.empty())
+            files.push_back(line);
     }
 
+    return true;
+}
+
+template<class Buffer>
+bool
+MCU::decode_swipe(SwipeDecoder& decoder, Buffer& input, unsigned int sample_rate,
+                  SwipeResult& result, const std::string& reader)
+{
     // Wait for a sample
     if(verbose)
     {
-        std::cerr << "Waiting for sample..." << std::endl;
+        std::lock_guard<std::mutex> lock(output_mutex);
+        std::cerr << "Waiting for sample" << (reader.empty() ? "" : " on reader ")
+                  << reader << "..." << std::endl;
+    }
+
+    // Get samples; stop at the end of input
+    if(! decoder.find_swipe(input, sample_rate))
+    {
+        return false;
     }
 
-    silence_pause();
+    // Swipe-to-result latency is measured from the detected end of the swipe
+    std::chrono::steady_clock::time_point swipe_end = std::chrono::steady_clock::now();
+
+    // Decode and print result
+    bool bits_found = decoder.decode_swipe(input, result);
+    std::chrono::steady_clock::duration latency = std::chrono::steady_clock::now() - swipe_end;
+
+    if(buffer->record_writer)
+    {
+        buffer->record_writer->write(reader, 0, result,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count());
+        return bits_found;
+    }
 
+    // Results of other readers may be printed meanwhile
+    std::lock_guard<std::mutex> lock(output_mutex);
 
-    // Get samples
-    get_dsp(sample_rate);
+    if(! reader.empty())
+    {
+        std::cout << "Reader: " << reader << std::endl;
+    }
 
-    // Extract samples
-    size_t samples = sample_end - sample_start;
-    std::vector<sample_t> sample_buffer(samples);
-    copy(buffer->begin() + sample_start,
-         buffer->begin() + sample_end,
-         std::back_inserter(sample_buffer));
+    print_result(result);
 
-    // Automatically set threshold if requested
-    if(auto_thres > 0)
+    // Print time spent between the end of the swipe and the result
+    if(verbose && bits_found)
     {
-        silence_thres = auto_thres * evaluate_max() / 100;
+        std::cerr << "Swipe-to-result latency: "
+                  << std::chrono::duration<double, std::milli>(latency).count()
+                  << " ms" << std::endl;
     }
 
+    return bits_found;
+}
+
+void
+MCU::print_result(const SwipeResult& result)
+{
     // Print silence threshold
     if(verbose)
     {
-        std::cerr << "Silence threshold: " << silence_thres
+        std::cerr << "Silence threshold: " << result.silence_thres
                   << " (" << auto_thres << "% of max)" << std::endl;
     }
 
-    // Decode result
-    decode_aiken_biphase(sample_buffer);
+    if(! result.bits_found)
+    {
+        std::cerr << "No bits detected!" << std::endl;
+        return;
+    }
 
     // Print bit string if needed
     if(verbose)
     {
-        std::cout << std::endl << "Bit string: " << bitstring << std::endl << std::endl;
+        std::cout << std::endl << "Bit string: " << result.bitstring.to_string() << std::endl << std::endl;
     }
 
-    // Create reversed bit string
-    std::string reversed_bitstring = bitstring;
-    std::reverse(reversed_bitstring.begin(), reversed_bitstring.end());
-
-    // Instantiate parsers
-    IATAParser iata_parser;
-    ABAParser aba_parser;
-    std::string decoded_string;
+    // Print thresholds that decoded the swipe after all
+    if(verbose && result.recovered)
+    {
+        std::cerr << "Recovered by re-decoding (threshold " << result.silence_thres
+                  << ", frequency threshold " << result.freq_thres << "%)" << std::endl;
+    }
 
-    // Try decoding using all available parsers
+    // Print results of all parsers
     std::cout << std::endl;
 
-    std::cout << "Decoding bitstring using " << iata_parser.get_name()
-              << " code:" << std::endl;
-    iata_parser.parse(bitstring, decoded_string);
-    std::cout << decoded_string << std::endl << std::endl;
+    for(size_t i = 0; i < result.tracks.size(); i++)
+    {
+        const TrackResult& track = result.tracks[i];
+
+        std::cout << "Decoding " << (track.reversed ? "reversed " : "")
+                  << "bitstring using " << track.parser
+                  << " code:" << std::endl;
+
+        if(track.status == PARSE_CHAR_PARITY)
+        {
+            std::cerr << "Character parity mismatch!" << std::endl;
+        }
+        else if(track.status == PARSE_LRC)
+        {
+            std::cerr << "Information parity mismatch!" << std::endl;
+        }
 
-    std::cout << "Decoding bitstring using " << aba_parser.get_name()
-              << " code:" << std::endl;
-    aba_parser.parse(bitstring, decoded_string);
-    std::cout << decoded_string << std::endl << std::endl;
+        std::cout << track.data << std::endl << std::endl;
+    }
 
-    std::cout << "Decoding reversed bitstring using " << iata_parser.get_name()
-              << " code:" << std::endl;
-    iata_parser.parse(reversed_bitstring, decoded_string);
-    std::cout << decoded_string << std::endl << std::endl;
+    // Report the encoding and direction that matched
+    const TrackResult* match = result.match();
+    if(match == NULL)
+    {
+        std::cerr << "No valid track found!" << std::endl;
+    }
+    else if(verbose)
+    {
+        std::cerr << "Valid track: " << match->parser
+                  << (match->reversed ? " (reversed)" : "") << std::endl;
+    }
+}
 
-    std::cout << "Decoding reversed bitstring using " << aba_parser.get_name()
-              << " code:" << std::endl;
-    aba_parser.parse(reversed_bitstring, decoded_string);
-    std::cout << decoded_string << std::endl << std::endl;
+bool
+MCU::print_card(const MultiTrackResult& card, const std::string& device)
+{
+    bool bits_found = false;
 
-    // Stop and close audio stream
-    cleanup();
+    // A record per track that saw the swipe
+    if(buffer->record_writer)
+    {
+        for(size_t i = 0; i < card.tracks.size(); i++)
+        {
+            if(! card.present[i])
+                continue;
+
+            buffer->record_writer->write(device, i + 1, card.tracks[i], 0);
+            bits_found = bits_found || card.tracks[i].bits_found;
+        }
+
+        return bits_found;
+    }
+
+    if(! device.empty())
+    {
+        std::cout << "Reader: " << device << std::endl;
+    }
+
+    // Print every track in turn
+    for(size_t i = 0; i < card.tracks.size(); i++)
+    {
+        std::cout << "Track " << i + 1 << ":" << std::endl;
+
+        if(! card.present[i])
+        {
+            std::cerr << "No swipe detected!" << std::endl;
+            continue;
+        }
+
+        print_result(card.tracks[i]);
+        bits_found = bits_found || card.tracks[i].bits_found;
+    }
+
+    // Report whether the tracks belong to the same card
+    if(! card.consistent)
+    {
+        std::cerr << "Account numbers of the tracks differ!" << std::endl;
+    }
+    else if(verbose && ! card.account.empty())
+    {
+        std::cerr << "Account number: " << card.account << std::endl;
+    }
 
+    return bits_found;
 }
 
 void
@@ -413,16 +1414,60 @@ MCU::print_help(void)
               << std::endl
               << "  -a,  --auto-thres   Set auto-thres percentage" << std::endl
               << "                      (default: " << AUTO_THRES << ")" << std::endl
-              << "  -d,  --device       Device (number) to read audio data from" << std::endl
-              << "                      (default: 0)" << std::endl
+              << "  -A,  --archive      Append the samples of every swipe to an" << std::endl
+              << "                      archive, for replaying them later" << std::endl
+              << "  -b,  --batch        Decode all recordings in a directory" << std::endl
+              << "                      or listed in a file, in parallel" << std::endl
+              << "  -B,  --buffer       Frames per buffer of the audio input" << std::endl
+              << "                      (default: " << BUFFER_FRAMES << ")" << std::endl
+              << "  -c,  --continuous   Keep decoding swipes until terminated" << std::endl
+              << "  -C,  --capture-cpus CPUs (separated by commas) to run the audio" << std::endl
+              << "                      input of the devices on, in turn" << std::endl
+              << "  -d,  --device       Devices (numbers, separated by commas) to read" << std::endl
+              << "                      audio data from (default: 0)" << std::endl
+              << "  -D,  --decode-cpus  CPUs (separated by commas) to decode the" << std::endl
+              << "                      readers on, in turn" << std::endl
+              << "  -e,  --encoding     Try a further encoding, given as" << std::endl
+              << "                      NAME:BITS:START:END:CHARSET[:MAX]" << std::endl
+              << "                      (e.g. ABA:5:11010:11111:0:40)" << std::endl
+              << "  -f,  --file         Decode recorded WAV or raw s16le file" << std::endl
+              << "                      instead of audio input" << std::endl
+              << "  -F,  --target-rate  Lowest sample rate to decode live input at;" << std::endl
+              << "                      faster devices are decimated, 0 for none" << std::endl
+              << "                      (default: " << TARGET_RATE << " Hz)" << std::endl
+              << "  -K,  --calibrate    Find the smallest buffer that runs for the" << std::endl
+              << "                      given minutes without losing input" << std::endl
               << "  -l,  --list-devices List compatible devices (enumerated)" << std::endl
+              << "  -L,  --low-latency  Ask the audio API for its lowest latency" << std::endl
               << "  -h,  --help         Print help information" << std::endl
-              << "  -m,  --max-level    Shows the maximum level" << std::endl
-              << "                      (use to determine threshold)" << std::endl
+              << "  -j,  --jobs         Number of threads for --batch" << std::endl
+              << "                      (default: all cores)" << std::endl
+              << "  -m,  --max-level    Show peak, RMS, noise floor and clipped samples" << std::endl
+              << "                      of every reader " << METER_RATE << " times a second while" << std::endl
+              << "                      decoding (use to determine threshold)" << std::endl
+              << "  -n,  --channels     Channels per device, each read as a reader" << std::endl
+              << "                      of its own (default: 1)" << std::endl
+              << "  -o,  --output       Format of the results: text, json (one" << std::endl
+              << "                      object per line) or binary records" << std::endl
+              << "                      (default: text)" << std::endl
+              << "  -p,  --periods      Buffers of the audio device" << std::endl
+              << "                      (default: chosen by the audio API)" << std::endl
+              << "  -P,  --replay       Decode the swipes of an archive instead" << std::endl
+              << "                      of audio input" << std::endl
+              << "  -r,  --sample-rate  Sample rate of raw files" << std::endl
+              << "                      (default: " << RAW_SAMPLE_RATE << ")" << std::endl
+              << "  -R,  --recover      Decode swipes failing parity or LRC again" << std::endl
+              << "                      with other thresholds, in parallel" << std::endl
               << "  -s,  --silent       No verbose messages" << std::endl
+              << "  -S,  --stats        Write timings of the decoding to a file" << std::endl
+              << "                      every " << METRICS_INTERVAL << " seconds" << std::endl
               << "  -t,  --threshold    Set silence threshold" << std::endl
               << "                      (default: automatic detect)" << std::endl
+              << "  -T,  --tracks       Channels are tracks 1, 2 (and 3) of one reader;" << std::endl
+              << "                      implies --channels 2 unless given" << std::endl
               << "  -v,  --version      Print version information" << std::endl
+              << "  -X,  --realtime     Run the audio input with realtime scheduling" << std::endl
+              << "                      at the given priority" << std::endl
               << std::endl;
 }
 
@@ -511,252 +1556,193 @@ MCU::greatest_sample_rate(int device_index)
     return max_rate;
 }
 
-void
-MCU::print_max_level(unsigned int sample_rate)
+unsigned int
+MCU::capture_sample_rate(int device_index, unsigned int& decimation)
 {
-    std::cout << "Terminating after " << MAX_TERM << " seconds..." << std::endl;
+    unsigned int capture_rate = greatest_sample_rate(device_index);
+    decimation = 1;
 
-    // Calculate maximal level
-    sample_t last_level = 0;
-    sample_t level;
-    for(size_t i = 0; i < MAX_TERM * sample_rate; i++)
+    // Greatest rate requested, or not even that fast enough
+    if(target_rate == 0 || capture_rate <= target_rate)
     {
-        // Wait if needed
-        if(buffer->size() <= i)
-            SLEEP(100);
+        return capture_rate;
+    }
+
+    // Lowest rate at least as fast as the target, either as supported
+    // by the device or after decimation; less work for the device first
+    RtAudio::DeviceInfo info = adc.getDeviceInfo(device_index);
+    unsigned int decimated_rate = capture_rate;
 
-        level = buffer->at(i);
+    for(size_t i = 0; i < info.sampleRates.size(); i++)
+    {
+        unsigned int rate = info.sampleRates[i];
+        if(rate < target_rate)
+            continue;
 
-        // Make level value absolute
-        if(level < 0)
+        // Largest factor dividing the rate evenly
+        unsigned int factor = std::min(rate / target_rate, (unsigned int) MAX_DECIMATION);
+        while(rate % factor != 0)
         {
-            level = -level;
+            factor--;
         }
 
-        // If current level is a (local) maximum, print it
-        if(level > last_level)
+        if(rate / factor < decimated_rate ||
+           (rate / factor == decimated_rate && rate < capture_rate))
         {
-            std::cout << "Maximum level: " << level << '\r';
-            last_level = level;
+            capture_rate = rate;
+            decimated_rate = rate / factor;
+            decimation = factor;
         }
     }
 
-    std::cout << std::endl;
+    return capture_rate;
 }
 
 void
-MCU::silence_pause(void)
+MCU::print_levels(const std::atomic<bool>& stop)
 {
-    while(true)
-    {
-        // Wait till buffer has enough data
-        while(buffer->size() <= buffer_index)
-        {
-            SLEEP(100);
-        }
-
-        for(; buffer_index < buffer->size(); buffer_index++)
-        {
-            // On first sample with absolute value
-            // greater than threshold bail out
-            sample_t sample = buffer->at(buffer_index);
-
-            if(sample < 0)
-            {
-                sample = -sample;
-            }
+    const size_t count = buffer->readers.size();
 
-            if(sample > silence_thres)
-            {
-                return;
-            }
-        }
+    // Levels are shown from now on
+    std::vector<LevelSnapshot> last(count);
+    for(size_t i = 0; i < count; i++)
+    {
+        buffer->readers[i]->stats.levels(last[i]);
+        buffer->readers[i]->stats.take_meter_peak();
     }
-}
-
-void
-MCU::get_dsp(unsigned int sample_rate)
-{
-    // Set start of the sample
-    sample_start = buffer_index;
-    sample_end = sample_start;
 
-    // Silence interval (in samples) indicating end of the sample
-    size_t silence_interval = (sample_rate * END_LENGTH) / 1000;
+    // A frame shows the levels since the last one; reading them costs
+    // the same whatever the sample rate
+    const std::chrono::steady_clock::duration frame = std::chrono::milliseconds(1000 / METER_RATE);
+    std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
 
-    // Loop until the end of the sample is found
-    while(true)
+    while(! stop)
     {
-        // Find supposed end of sample (sample below threshold)
-        for(; buffer_index < buffer->size(); buffer_index++)
-        {
-            sample_t sample = buffer->at(buffer_index);
-
-            if(sample < 0)
-            {
-                sample = -sample;
-            }
+        next += frame;
+        std::this_thread::sleep_until(next);
 
-            if(sample < silence_thres)
-            {
-                sample_end = buffer_index;
-                break;
-            }
-        }
+        std::lock_guard<std::mutex> lock(output_mutex);
 
-        // Wait till buffer has enough data
-        while(buffer->size() - sample_end < silence_interval)
+        for(size_t i = 0; i < count; i++)
         {
-            SLEEP(100);
-        }
+            SignalStats& stats = buffer->readers[i]->stats;
+            LevelSnapshot levels;
+            stats.levels(levels);
 
-        // Check whether the supposed end of the sample is the real one
-        size_t silence_counter;
-        for(silence_counter = 0;
-            silence_counter < silence_interval;
-            silence_counter++, buffer_index++)
-        {
-            sample_t sample = buffer->at(buffer_index);
+            const uint64_t samples = levels.samples - last[i].samples;
+            const int rms = samples > 0 ?
+                (int) std::sqrt((double) (levels.squares - last[i].squares) / samples) : 0;
 
-            if(sample < 0)
-            {
-                sample = -sample;
-            }
+            if(count > 1)
+                std::cerr << (i > 0 ? "  " : "") << buffer->readers[i]->name << ": ";
 
-            if(sample > silence_thres)
-            {
-                break;
-            }
-        }
+            std::cerr << "peak " << std::setw(5) << stats.take_meter_peak()
+                      << "  rms " << std::setw(5) << rms
+                      << "  noise " << std::setw(5) << stats.noise_floor()
+                      << "  max " << std::setw(5) << levels.max_peak
+                      << "  clipped " << levels.clipped;
 
-        // If silence continued longer than the allowed interval, end recording
-        if(silence_counter == silence_interval)
-        {
-            return;
+            last[i] = levels;
         }
+
+        std::cerr << '\r' << std::flush;
     }
+
+    std::cerr << std::endl;
 }
 
 void
-MCU::decode_aiken_biphase(std::vector<sample_t>& input)
+MCU::watch_input(void)
 {
-    const size_t input_size = input.size();
-
-    // Make all values absolute
-    for(size_t i = 0; i < input_size; i++)
+    // Decoders end at the end of input
+    if(interrupted)
     {
-        if(input[i] < 0)
+        for(size_t i = 0; i < buffer->readers.size(); i++)
         {
-            input[i] = -input[i];
+            buffer->readers[i]->ring.close();
         }
     }
 
-    // Search for peaks
-    size_t peak_index = 0;
-    size_t old_peak_index = 0;
-    std::vector<size_t> peaks;
-    for(size_t i = 0; i < input_size; )
-    {
-        // Store peak index
-        old_peak_index = peak_index;
-
-        // Search for the next peak
-        for(; i < input_size && input[i] <= silence_thres; i++)
-        {
-        }
+    std::lock_guard<std::mutex> lock(output_mutex);
 
-        peak_index = 0;
+    for(size_t i = 0; i < buffer->streams.size(); i++)
+    {
+        StreamInput& stream = *buffer->streams[i];
 
-        for(; i < input_size && input[i] > silence_thres; i++)
+        if(stream.pin_failed && ! stream.pin_reported)
         {
-            if(input[i] > input[peak_index])
-            {
-                peak_index = i;
-            }
+            stream.pin_reported = true;
+            std::cerr << "Warning: Could not bind input of device " << stream.name
+                      << " to CPU " << stream.cpu << "!" << std::endl;
         }
 
-        size_t peak_index_diff = peak_index - old_peak_index;
-        if(peak_index_diff > 0)
+        // Input lost by the device; the calibration reports it itself
+        const uint64_t overflows = stream.overflows;
+        if(overflows > stream.reported_overflows && ! stream.calibrating)
         {
-            peaks.push_back(peak_index_diff);
+            stream.reported_overflows = overflows;
+            std::cerr << "Audio input overflow"
+                      << (buffer->streams.size() > 1 ? " of device " + stream.name : "")
+                      << " (" << overflows << " so far)!" << std::endl;
         }
     }
 
-    // If less than two peaks found, something went wrong
-    if(peaks.size() < 2)
-    {
-        std::cerr << "No bits detected!" << std::endl;
-        cleanup();
-        exit(EXIT_FAILURE);
-    }
-
-    // Decode aiken bi-phase (decode bits based on intervals between peaks)
-    sample_t zero = peaks[2];
-    const size_t peaks_size = peaks.size();
-    for(size_t i = 2; i < peaks_size - 1; i++)
+    // Samples lost because the buffer was full
+    for(size_t i = 0; i < buffer->readers.size(); i++)
     {
-        size_t interval0 = (FREQ_THRES * zero) / 100;
-        size_t interval1 = interval0 / 2;
+        ReaderInput& reader = *buffer->readers[i];
+        const size_t dropped = reader.ring.dropped();
 
-        if(peaks[i] < ((zero / 2) + interval1) &&
-           peaks[i] > ((zero / 2) - interval1))
-        {
-            if(peaks[i + 1] < ((zero / 2) + interval1) &&
-               peaks[i + 1] > ((zero / 2) - interval1))
-            {
-                bitstring.push_back('1');
-                zero = peaks[i] * 2;
-                i++;
-            }
-        }
-        else if(peaks[i] < (zero + interval0) &&
-                peaks[i] > (zero - interval0))
+        if(dropped > reader.reported_dropped)
         {
-            bitstring.push_back('0');
-            zero = peaks[i];
+            reader.reported_dropped = dropped;
+            std::cerr << "Input buffer overrun"
+                      << (buffer->readers.size() > 1 ? " of reader " + reader.name : "")
+                      << ": " << dropped << " samples dropped!" << std::endl;
         }
     }
 }
 
-sample_t
-MCU::evaluate_max(void)
+void
+MCU::cleanup(void)
 {
-    sample_t max = 0;
-
-    for(size_t i = 0; i < buffer->size(); i++)
+    for(size_t i = 0; i < adcs.size(); i++)
     {
-        sample_t value = buffer->at(i);
-        if(value > max)
+        // Stop audio stream
+        try
         {
-            max = value;
+            if(adcs[i]->isStreamRunning())
+                adcs[i]->stopStream();
+        }
+        catch(RtAudioError& e)
+        {
+            std::cerr << std::endl << e.getMessage() << std::endl;
+            exit(EXIT_FAILURE);
         }
-    }
-
-    return max;
-}
 
-void
-MCU::cleanup(void)
-{
-    // Stop audio stream
-    try
-    {
-        adc.stopStream();
+        // Close audio stream
+        if(adcs[i]->isStreamOpen())
+            adcs[i]->closeStream();
     }
-    catch(RtAudioError& e)
-    {
-        std::cerr << std::endl << e.getMessage() << std::endl;
-        exit(EXIT_FAILURE);
-    }
-
-    // Close audio stream
-    if(adc.isStreamOpen())
-        adc.closeStream();
 }
 
 
-// Input data buffer
-std::vector<sample_t> buf;
+// Input data buffers
+LiveInput buf;
+
+// Hand a block of samples over to the decoder of a reader
+static void
+store_samples(ReaderInput* reader, const sample_t* block, size_t count, Metrics* metrics)
+{
+    // Statistics are complete before the samples become visible
+    reader->stats.update(block, count);
+
+    // Copy audio input data to buffer; if the consumer lags behind,
+    // what does not fit is dropped rather than allocating more memory
+    const size_t dropped = reader->ring.dropped();
+    if(! reader->ring.write(block, count) && metrics != NULL)
+        metrics->dropped.fetch_add(reader->ring.dropped() - dropped, std::memory_order_relaxed);
+}
 
 // RtAudio input function
 int
@@ -765,20 +1751,67 @@ input(void* out_buffer, void* in_buffer, unsigned int n_buffer_frames,
 {
     (void) out_buffer;
     (void) stream_time;
-    (void) data;
 
-    // Check for audio input overflow
-    if(status == RTAUDIO_INPUT_OVERFLOW)
+    StreamInput* stream = (StreamInput*) data;
+    Metrics* metrics = stream->metrics;
+    uint64_t start = metrics != NULL ? monotonic_ns() : 0;
+
+    // Bind the callback thread to its CPU with the first block
+    if(stream->cpu >= 0 && ! stream->pinned)
+    {
+        stream->pinned = true;
+        if(! pin_thread(stream->cpu))
+            stream->pin_failed.store(true, std::memory_order_relaxed);
+    }
+
+    // Check for audio input overflow; the main thread reports it.
+    // While calibrating, the buffer size of this run has failed
+    if(status & RTAUDIO_INPUT_OVERFLOW)
+    {
+        if(metrics != NULL)
+            metrics->overflows.fetch_add(1, std::memory_order_relaxed);
+
+        stream->overflows.fetch_add(1, std::memory_order_relaxed);
+
+        if(stream->calibrating)
+        {
+            for(size_t i = 0; i < stream->readers.size(); i++)
+            {
+                stream->readers[i]->ring.close();
+            }
+            return 2;
+        }
+    }
+
+    // Every channel feeds a reader of its own
+    for(size_t i = 0; i < stream->readers.size(); i++)
     {
-        std::cerr << "Audio input overflow!"<< std::endl;
-        return 2;
+        ReaderInput* reader = stream->readers[i];
+        const sample_t* block = (const sample_t*) in_buffer + i * n_buffer_frames;
+        const unsigned int factor = reader->decimator.get_factor();
+
+        if(factor == 1)
+        {
+            store_samples(reader, block, n_buffer_frames, metrics);
+            continue;
+        }
+
+        // Reduce the sample rate first, on the stack, a part at a time
+        for(size_t offset = 0; offset < n_buffer_frames; offset += DECIMATE_CHUNK * factor)
+        {
+            sample_t decimated[DECIMATE_CHUNK];
+            size_t length = std::min((size_t) n_buffer_frames - offset,
+                                     (size_t) DECIMATE_CHUNK * factor);
+            size_t count = reader->decimator.process(block + offset, length, decimated);
+
+            store_samples(reader, decimated, count, metrics);
+        }
     }
 
-    // Copy audio input data to buffer
-    sample_t* src = (sample_t*) in_buffer;
-    for(unsigned int i = 0; i < n_buffer_frames; i++, src++)
+    if(metrics != NULL)
     {
-        buf.push_back(*src);
+        metrics->callback(start, stream->last_callback, n_buffer_frames, stream->sample_rate);
+        stream->last_callback = start;
     }
 
     return 0;
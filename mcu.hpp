@@ -11,12 +11,26 @@
 #ifndef MCU_HPP
 #define MCU_HPP
 
+#include <atomic>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
 #include "RtAudio.h"
 
+#include "archive.hpp"
+#include "decimator.hpp"
+#include "decoder.hpp"
+#include "metrics.hpp"
+#include "metricswriter.hpp"
+#include "multitrack.hpp"
+#include "output.hpp"
+#include "parser.hpp"
+#include "soundfile.hpp"
+#include "threadpool.hpp"
+
 #include <inttypes.h>
 
 // For assertions
@@ -27,78 +41,101 @@
 // Version of the program
 #define VERSION 1.1
 
-// Initial silence threshold
-#define SILENCE_THRES 5000
+// Frames per buffer of the audio input
+#define BUFFER_FRAMES 512
+
+// Buffer sizes tried by the calibration (in frames)
+#define CALIBRATE_MIN_FRAMES 32
+#define CALIBRATE_MAX_FRAMES 8192
+
+// Frames per second of the level meter
+#define METER_RATE 10
 
-// Percent of highest value to set silence_thres to
-#define AUTO_THRES 30
+// Interval of the checks on live input while decoding (in ms)
+#define WATCH_INTERVAL 100
 
-// Frequency threshold (in percent)
-#define FREQ_THRES 60
+// Sample rate of raw input files (in Hz)
+#define RAW_SAMPLE_RATE 44100
 
-// Seconds before termination of print_max_level()
-#define MAX_TERM 60
+// Fastest swipe to be decoded (in mm/s)
+#define MAX_SWIPE_SPEED 1000
 
-// Silence interval after sample (in milliseconds)
-#define END_LENGTH 200
+// Highest bit density of a track (in bits per meter; 210 bits per inch)
+#define MAX_BIT_DENSITY 8268
 
-// We use signed 16 bit value as a sample
-typedef int16_t sample_t;
+// Samples per bit the decoder needs, with some margin
+#define MIN_SAMPLES_PER_BIT 8
 
+// Lowest sample rate to decode at (in Hz)
+#define TARGET_RATE (MIN_SAMPLES_PER_BIT * MAX_BIT_DENSITY * MAX_SWIPE_SPEED / 1000)
 
 /**
-    Definition of the magnetic bitstring parser.
+    Input of one reader, i.e. one channel of an input device, shared
+    between the RtAudio callback and the decoder of the reader. If the
+    device runs faster than needed, samples are decimated before they
+    are stored.
 */
-class MagneticBitstringParser
+struct ReaderInput
 {
-public:
-    virtual ~MagneticBitstringParser(void) {  }
-    virtual void parse(std::string& bitstring, std::string& result);
-    void set_name(const char* parser_name) { name = parser_name; }
-    std::string get_name(void) { return name; }
-    void set_char_length(unsigned int length) { char_length = length; parity_bit = length - 1; }
-    void set_start_sentinel(const char* sentinel) { assert(strlen(sentinel) == char_length); start_sentinel = sentinel; }
-    void set_end_sentinel(const char* sentinel) { assert(strlen(sentinel) == char_length); end_sentinel = sentinel; }
-    unsigned char decode_char(std::string& bits);
-    bool check_parity(std::string& bits);
-protected:
-    std::string name; // of the encoding
-    unsigned int char_length; // in bits
-    unsigned int parity_bit;
-    std::string start_sentinel;
-    std::string end_sentinel;
+    ReaderInput(size_t capacity, unsigned int decimation = 1) :
+        ring(capacity), decimator(decimation), sample_rate(0), reported_dropped(0) {  }
+
+    SampleRing ring;    // Samples
+    SignalStats stats;  // Levels of the samples, updated with every block
+    Decimator decimator;    // Used by the callback only
+    unsigned int sample_rate;   // Of the samples, i.e. after decimation
+    std::string name;   // Tag of the results, "device:channel"
+    size_t reported_dropped;    // Used by the main thread only
 };
 
 /**
-    Definition of IATA parser.
+    Open input stream of one device. Channels are delivered one after
+    another (not interleaved); channel i goes to readers[i].
 */
-class IATAParser : public MagneticBitstringParser
+struct StreamInput
 {
-public:
-    IATAParser(void)
-    {
-        set_name("IATA");
-        set_char_length(7);
-        set_start_sentinel("1010001");
-        set_end_sentinel("1111100");
-    }
-    virtual ~IATAParser(void) {  }
+    StreamInput(void) :
+        sample_rate(0), buffer_frames(0), cpu(-1), pinned(false), pin_failed(false),
+        calibrating(false), overflows(0), last_callback(0), metrics(NULL),
+        pin_reported(false), reported_overflows(0) {  }
+
+    std::vector<ReaderInput*> readers;
+    std::string name;   // Device number
+    unsigned int sample_rate;   // Of the device
+    unsigned int buffer_frames; // As granted by the device
+    int cpu;            // To bind the callback thread to; -1 for any
+    bool pinned;        // Callback thread is bound; used by the callback only
+    std::atomic<bool> pin_failed;   // Binding failed; reported by the main thread
+    bool calibrating;   // Lost input aborts the stream, to try a larger buffer
+    std::atomic<uint64_t> overflows;    // Times input was lost
+    uint64_t last_callback;     // Start of the last callback
+    Metrics* metrics;           // NULL if not measured
+
+    // Used by the main thread only
+    bool pin_reported;
+    uint64_t reported_overflows;
 };
 
 /**
-    Definition of ABA parser.
+    Live input of all readers, and timings of the whole pipeline.
 */
-class ABAParser : public MagneticBitstringParser
+struct LiveInput
 {
-public:
-    ABAParser(void)
-    {
-        set_name("ABA");
-        set_char_length(5);
-        set_start_sentinel("11010");
-        set_end_sentinel("11111");
-    }
-    virtual ~ABAParser(void) {  }
+    LiveInput(void) : measured(false) {  }
+
+    std::vector<std::unique_ptr<ReaderInput> > readers;
+    std::vector<std::unique_ptr<StreamInput> > streams;
+
+    // Timings of the pipeline, written to a file if measured
+    Metrics metrics;
+    bool measured;
+    std::unique_ptr<MetricsWriter> metrics_writer;
+
+    // Writer of machine-readable results, if requested
+    std::unique_ptr<RecordWriter> record_writer;
+
+    // Archive of the swipes, if requested
+    std::unique_ptr<ArchiveWriter> archive;
 };
 
 /**
@@ -114,7 +151,7 @@ class MCU
 {
 public:
     MCU(int argc, char** argv);
-    void run(RtAudioCallback input_function, std::vector<sample_t>* b);
+    void run(RtAudioCallback input_function, LiveInput* b);
 private:
     // Methods
     void print_version(void);
@@ -122,31 +159,68 @@ private:
     void list_devices(std::vector<RtAudio::DeviceInfo>& dev, std::vector<int>& index);
     void print_devices(std::vector<RtAudio::DeviceInfo>& dev);
     unsigned int greatest_sample_rate(int device_index);
-    void print_max_level(unsigned int sample_rate);
-    void silence_pause(void);
-    void get_dsp(unsigned int sample_rate);
-    void decode_aiken_biphase(std::vector<sample_t>& input);
-    sample_t evaluate_max(void);
+    unsigned int capture_sample_rate(int device_index, unsigned int& decimation);
+    bool parse_devices(const char* list);
+    bool parse_numbers(const char* list, std::vector<int>& numbers);
+    void open_readers(RtAudioCallback input_function);
+    void close_readers(void);
+    void calibrate_buffer(RtAudioCallback input_function);
+    void decode_readers(void);
+    void print_levels(const std::atomic<bool>& stop);
+    void watch_input(void);
+    void decode_file(const char* file_name);
+    void decode_batch(const char* path);
+    void decode_archive(const char* file_name);
+    bool list_batch(const char* path, std::vector<std::string>& files);
+    template<class Buffer> bool decode_swipe(SwipeDecoder& decoder, Buffer& input,
+                                             unsigned int sample_rate, SwipeResult& result,
+                                             const std::string& reader = "");
+    bool decode_track(SwipeDecoder& decoder, ReaderInput& reader, unsigned int track,
+                      SwipeCollector& collector, SwipeResult& result,
+                      MultiTrackResult& card, const std::string& device,
+                      std::atomic<bool>& failed);
+    void print_result(const SwipeResult& result);
+    bool print_card(const MultiTrackResult& card, const std::string& device);
     void cleanup(void);
 
     // Properties
-    RtAudio adc;    // Sound input
+    RtAudio adc;    // Sound input; lists the devices
+    std::vector<std::unique_ptr<RtAudio> > adcs;    // Open input streams, one per device
     std::vector<RtAudio::DeviceInfo> devices;    // List of devices
     std::vector<int> device_indexes; // List of original device indexes
-    std::vector<sample_t>* buffer;
-    unsigned int buffer_index;  // Current buffer index  = 0
-    // Start and end index of sample
-    unsigned int sample_start;
-    unsigned int sample_end;
-    std::string bitstring;   // String of bits
+    LiveInput* buffer;
+    std::mutex output_mutex;    // Results of several readers are printed whole
     sample_t silence_thres; // Silence threshold     = SILENCE_THRES
 
     // Configuration properties
     int auto_thres; //  = AUTO_THRES
-    bool max_level; //  = false
+    bool max_level; // Show the level meter = false
     bool verbose;   //  = true
     bool list_input_devices;    //  = false
-    int device_number;  //  = 0
+    bool continuous;    //  = false
+    std::vector<int> device_numbers;    //  = 0
+    unsigned int channels;  // Readers per device = 1
+    bool multitrack;    // Channels are tracks of one reader = false
+    std::vector<Encoding> user_encodings;   // Given on the command line
+    EncodingRegistry encodings; // Standard and user encodings
+    std::string input_file; // Recording to decode instead of live input
+    unsigned int raw_sample_rate;   //  = RAW_SAMPLE_RATE
+    unsigned int target_rate;   // Of live input; 0 = greatest of the device  = TARGET_RATE
+    std::string batch_path; // Directory or list of recordings to decode
+    std::string archive_file;   // Archive to append swipes to, if any
+    std::string replay_file;    // Archive to decode instead of live input
+    unsigned int jobs;  // Decoding threads; 0 = all cores
+    bool recover;   // Re-decode failed swipes with other thresholds = false
+    std::unique_ptr<ThreadPool> recovery_pool;  // Used to, unless in batch mode
+    std::string stats_file; // File to write metrics to, if any
+    OutputFormat output_format; //  = OUTPUT_TEXT
+    unsigned int buffer_frames; // Of the audio input = BUFFER_FRAMES
+    unsigned int periods;   // Buffers of the device; 0 = default of the API
+    bool low_latency;   // Ask the API for the lowest latency = false
+    int realtime_priority;  // Of the callback thread; 0 = default scheduling
+    std::vector<int> capture_cpus;  // CPUs of the callback threads, per device
+    std::vector<int> decode_cpus;   // CPUs of the decoding threads, per reader
+    double calibrate_minutes;   // Run of each buffer size; 0 = no calibration
 };
 
 
@@ -0,0 +1,115 @@
+/**
+    metrics.hpp
+
+    Latency histograms and counters of the decoding pipeline.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <atomic>
+#include <chrono>
+
+#include <inttypes.h>
+
+
+// Monotonic time (in nanoseconds)
+inline uint64_t
+monotonic_ns(void)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+/**
+    Histogram of durations with buckets growing by powers of two.
+
+    Recording is lock-free and never waits, so it may happen in the
+    audio callback; bucket i counts durations below 2^i nanoseconds.
+*/
+class Histogram
+{
+public:
+    static const unsigned int bucket_count = 64;
+
+    Histogram(void) : total(0), sum_ns(0)
+    {
+        for(unsigned int i = 0; i < bucket_count; i++)
+        {
+            buckets[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    Histogram(const Histogram&) = delete;
+    Histogram& operator=(const Histogram&) = delete;
+
+    void record(uint64_t ns)
+    {
+        unsigned int index = 0;
+        for(uint64_t value = ns; value != 0 && index < bucket_count - 1; value >>= 1)
+        {
+            index++;
+        }
+
+        buckets[index].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum_ns.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    uint64_t bucket(unsigned int index) const { return buckets[index].load(std::memory_order_relaxed); }
+    uint64_t count(void) const { return total.load(std::memory_order_relaxed); }
+    uint64_t sum(void) const { return sum_ns.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> buckets[bucket_count];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum_ns;
+};
+
+
+/**
+    Measurements of the whole pipeline, from audio callback to parser.
+*/
+struct Metrics
+{
+    Metrics(void) : overflows(0), dropped(0) {  }
+
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    /**
+        Account a run of the audio callback that started at start
+        and delivered the given number of frames; last is the start
+        of the previous run of the same stream, or 0.
+    */
+    void callback(uint64_t start, uint64_t last, unsigned int frames, unsigned int sample_rate)
+    {
+        callback_time.record(monotonic_ns() - start);
+
+        // Deviation from the period the frames should take
+        if(last != 0 && sample_rate != 0)
+        {
+            uint64_t interval = start - last;
+            uint64_t period = (uint64_t) frames * 1000000000ULL / sample_rate;
+
+            callback_jitter.record(interval > period ? interval - period : period - interval);
+        }
+    }
+
+    Histogram callback_time;    // Execution time of the audio callback
+    Histogram callback_jitter;  // Deviation of callback intervals
+    Histogram swipe_time;       // First loud sample to end of swipe found
+    Histogram decode_time;      // Bits out of samples
+    Histogram parse_time;       // Characters out of bits
+
+    std::atomic<uint64_t> overflows;    // Reported by the audio device
+    std::atomic<uint64_t> dropped;      // Samples that did not fit the buffer
+};
+
+
+#endif /* METRICS_HPP */
@@ -0,0 +1,131 @@
+/**
+    metricswriter.cpp
+
+    Periodic dumps of the metrics of the decoding pipeline.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#include "metricswriter.hpp"
+
+#include <cstdio>
+#include <fstream>
+
+
+// Histogram in Prometheus text format, in seconds
+static void
+write_histogram(std::ostream& out, const char* name, const char* help,
+                const Histogram& histogram)
+{
+    out << "# HELP " << name << " " << help << "\n"
+        << "# TYPE " << name << " histogram\n";
+
+    // Buckets are cumulative; empty ones at the end are left out
+    unsigned int last = 0;
+    for(unsigned int i = 0; i < Histogram::bucket_count; i++)
+    {
+        if(histogram.bucket(i) != 0)
+            last = i;
+    }
+
+    uint64_t cumulative = 0;
+    for(unsigned int i = 0; i <= last; i++)
+    {
+        cumulative += histogram.bucket(i);
+        out << name << "_bucket{le=\"" << (double) (1ULL << i) / 1e9 << "\"} "
+            << cumulative << "\n";
+    }
+
+    out << name << "_bucket{le=\"+Inf\"} " << histogram.count() << "\n"
+        << name << "_sum " << (double) histogram.sum() / 1e9 << "\n"
+        << name << "_count " << histogram.count() << "\n";
+}
+
+// Counter in Prometheus text format
+static void
+write_counter(std::ostream& out, const char* name, const char* help, uint64_t value)
+{
+    out << "# HELP " << name << " " << help << "\n"
+        << "# TYPE " << name << " counter\n"
+        << name << " " << value << "\n";
+}
+
+
+MetricsWriter::MetricsWriter(const Metrics& source, const std::string& file_name) :
+        metrics(source), path(file_name), stopping(false)
+{
+    thread = std::thread(&MetricsWriter::run, this);
+}
+
+MetricsWriter::~MetricsWriter(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    stop_condition.notify_one();
+    thread.join();
+
+    // Final state
+    write();
+}
+
+bool
+MetricsWriter::write(void)
+{
+    // Write a new file and replace the old one with it
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary.c_str());
+        if(! out)
+            return false;
+
+        write_histogram(out, "mcu_callback_seconds",
+                        "Execution time of the audio callback", metrics.callback_time);
+        write_histogram(out, "mcu_callback_jitter_seconds",
+                        "Deviation of audio callback intervals from the buffer period",
+                        metrics.callback_jitter);
+        write_histogram(out, "mcu_swipe_seconds",
+                        "Time from the first loud sample to the detected end of a swipe",
+                        metrics.swipe_time);
+        write_histogram(out, "mcu_decode_seconds",
+                        "Time spent decoding bits out of the samples of a swipe",
+                        metrics.decode_time);
+        write_histogram(out, "mcu_parse_seconds",
+                        "Time spent decoding characters out of the bits of a swipe",
+                        metrics.parse_time);
+        write_counter(out, "mcu_input_overflows_total",
+                      "Input overflows reported by the audio device",
+                      metrics.overflows.load(std::memory_order_relaxed));
+        write_counter(out, "mcu_dropped_samples_total",
+                      "Samples dropped because the input buffer was full",
+                      metrics.dropped.load(std::memory_order_relaxed));
+
+        if(! out)
+            return false;
+    }
+
+#if defined( __WINDOWS_ASIO__ ) || defined( __WINDOWS_DS__ )
+    // Renaming does not replace existing files there
+    std::remove(path.c_str());
+#endif
+
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+void
+MetricsWriter::run(void)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while(! stopping)
+    {
+        stop_condition.wait_for(lock, std::chrono::seconds(METRICS_INTERVAL));
+
+        if(! stopping)
+            write();
+    }
+}
@@ -0,0 +1,56 @@
+/**
+    metricswriter.hpp
+
+    Periodic dumps of the metrics of the decoding pipeline.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#ifndef METRICSWRITER_HPP
+#define METRICSWRITER_HPP
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "metrics.hpp"
+
+
+// Seconds between two dumps of the metrics
+#define METRICS_INTERVAL 10
+
+
+/**
+    Thread writing the metrics to a file periodically, in Prometheus
+    text exposition format. The file is replaced as a whole, so that
+    readers never see it half-written.
+*/
+class MetricsWriter
+{
+public:
+    MetricsWriter(const Metrics& source, const std::string& file_name);
+    ~MetricsWriter(void);
+
+    MetricsWriter(const MetricsWriter&) = delete;
+    MetricsWriter& operator=(const MetricsWriter&) = delete;
+
+    // Write the current state now
+    bool write(void);
+
+private:
+    void run(void);
+
+    const Metrics& metrics;
+    std::string path;
+
+    std::mutex mutex;
+    std::condition_variable stop_condition;
+    bool stopping;
+    std::thread thread;
+};
+
+
+#endif /* METRICSWRITER_HPP */
@@ -0,0 +1,183 @@
+/**
+    multitrack.cpp
+
+    Swipes read by several heads at once, one track per channel.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#include "multitrack.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+
+EncodingRegistry
+track_encodings(unsigned int track)
+{
+    EncodingRegistry encodings;
+
+    if(track == 1)
+    {
+        encodings.add(Encoding::iata());
+    }
+    else
+    {
+        encodings.add(Encoding::aba());
+        encodings.add(Encoding::thrift());
+    }
+
+    return encodings;
+}
+
+
+SwipeCollector::SwipeCollector(const std::vector<const SampleRing*>& track_rings,
+                               size_t window_length) :
+        rings(track_rings), window(window_length),
+        pending(track_rings.size()), pending_count(track_rings.size(), 0),
+        decoding(track_rings.size(), false), cards(0)
+{
+}
+
+size_t
+SwipeCollector::card_count(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return cards;
+}
+
+void
+SwipeCollector::begin_swipe(unsigned int track)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    decoding[track] = true;
+}
+
+void
+SwipeCollector::add_swipe(unsigned int track, size_t start, SwipeResult& result)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // Reuse a free slot, and the buffers of the result in it
+        std::vector<PendingSwipe>& swipes = pending[track];
+        if(pending_count[track] == swipes.size())
+            swipes.push_back(PendingSwipe());
+
+        PendingSwipe& swipe = swipes[pending_count[track]++];
+        swipe.start = start;
+        std::swap(swipe.result, result);
+
+        decoding[track] = false;
+    }
+
+    changed.notify_all();
+}
+
+bool
+SwipeCollector::next_card(MultiTrackResult& card)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while(true)
+    {
+        bool any_pending = false;
+        for(size_t i = 0; i < pending.size(); i++)
+        {
+            any_pending = any_pending || pending_count[i] > 0;
+        }
+
+        if(! any_pending)
+            return false;
+
+        if(take_card(card))
+        {
+            cards++;
+            changed.notify_all();
+            return true;
+        }
+
+        // Silent tracks do not report; look at their progress again soon
+        changed.wait_for(lock, std::chrono::milliseconds(COLLECT_POLL));
+    }
+}
+
+bool
+SwipeCollector::take_card(MultiTrackResult& card)
+{
+    const unsigned int count = track_count();
+
+    // Earliest swipe of all tracks
+    size_t start = (size_t) -1;
+    for(unsigned int i = 0; i < count; i++)
+    {
+        if(pending_count[i] > 0 && pending[i][0].start < start)
+            start = pending[i][0].start;
+    }
+
+    // Every track has either seen the card or passed it in silence
+    card.present.assign(count, false);
+    for(unsigned int i = 0; i < count; i++)
+    {
+        if(pending_count[i] > 0 && pending[i][0].start <= start + window)
+        {
+            card.present[i] = true;
+        }
+        else if(decoding[i])
+        {
+            return false;
+        }
+        else if(pending_count[i] == 0 && rings[i]->begin() <= start + window &&
+                ! rings[i]->is_closed())
+        {
+            return false;
+        }
+    }
+
+    card.tracks.resize(count);
+    for(unsigned int i = 0; i < count; i++)
+    {
+        SwipeResult& track = card.tracks[i];
+
+        if(card.present[i])
+        {
+            // The result of the card before goes to the free slot
+            std::swap(track, pending[i][0].result);
+            std::rotate(pending[i].begin(), pending[i].begin() + 1,
+                        pending[i].begin() + pending_count[i]);
+            pending_count[i]--;
+        }
+        else
+        {
+            track.clear();
+            track.bits_found = false;
+            track.silence_thres = 0;
+            track.freq_thres = 0;
+            track.recovered = false;
+        }
+    }
+
+    // Tracks decoded without errors have to name the same account
+    card.account.clear();
+    card.consistent = true;
+    for(unsigned int i = 0; i < count; i++)
+    {
+        const TrackResult* match = card.tracks[i].match();
+        if(match == NULL)
+            continue;
+
+        account_number(*match, account);
+        if(account.empty())
+            continue;
+
+        if(card.account.empty())
+            card.account = account;
+        else if(account != card.account)
+            card.consistent = false;
+    }
+
+    return true;
+}
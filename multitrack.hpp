@@ -0,0 +1,115 @@
+/**
+    multitrack.hpp
+
+    Swipes read by several heads at once, one track per channel.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#ifndef MULTITRACK_HPP
+#define MULTITRACK_HPP
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "decoder.hpp"
+#include "encodings.hpp"
+#include "parser.hpp"
+
+
+// Largest number of tracks of a card
+#define MAX_TRACKS 3
+
+// Interval between checks whether silent tracks passed a swipe (in milliseconds)
+#define COLLECT_POLL 5
+
+
+/**
+    Encodings of a track (numbered from 1): IATA on track 1, ABA and
+    Thrift on tracks 2 and 3.
+*/
+EncodingRegistry track_encodings(unsigned int track);
+
+
+/**
+    Swipe of a card over all heads of a reader.
+*/
+struct MultiTrackResult
+{
+    std::vector<bool> present;          // Whether the track saw the swipe
+    std::vector<SwipeResult> tracks;    // Per track, numbered from 0
+
+    // Account numbers of the decoded tracks; the first one if they agree
+    std::string account;
+    bool consistent;        // Decoded tracks agree with each other
+};
+
+
+/**
+    Collects the swipes decoded on the tracks of one reader into one
+    result per card.
+
+    The tracks share the sample clock of the stream, so swipes whose
+    first samples lie within window samples of each other belong to
+    the same card. A track without such a swipe is known to be blank
+    once its decoder released samples past the window, i.e. scanned
+    them as silence; until then the card is held back. Decoders of the
+    tracks run concurrently, so a card is complete as soon as its
+    slowest track is. Results are exchanged, not copied: a track gets
+    the buffers of a result taken before in return for its swipe, so
+    that a steady stream of cards needs no allocations.
+*/
+class SwipeCollector
+{
+public:
+    SwipeCollector(const std::vector<const SampleRing*>& track_rings, size_t window_length);
+
+    SwipeCollector(const SwipeCollector&) = delete;
+    SwipeCollector& operator=(const SwipeCollector&) = delete;
+
+    unsigned int track_count(void) const { return (unsigned int) rings.size(); }
+    // Cards taken so far
+    size_t card_count(void);
+
+    // The decoder of a track found a swipe and decodes it now
+    void begin_swipe(unsigned int track);
+    // The swipe that started at the given position is decoded; the
+    // result is exchanged for one to reuse
+    void add_swipe(unsigned int track, size_t start, SwipeResult& result);
+
+    /**
+        Wait until the earliest card is complete and take it, in
+        exchange for the tracks of the card given; false if no swipe
+        is pending anymore, e.g. taken by another track.
+    */
+    bool next_card(MultiTrackResult& card);
+
+private:
+    struct PendingSwipe
+    {
+        size_t start;
+        SwipeResult result;
+    };
+
+    bool take_card(MultiTrackResult& card);
+
+    std::vector<const SampleRing*> rings;
+    size_t window;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    // Per track, oldest first; slots past the count keep the buffers
+    // of results taken before
+    std::vector<std::vector<PendingSwipe> > pending;
+    std::vector<size_t> pending_count;
+    std::vector<bool> decoding;     // Swipe found, but not added yet
+    std::string account;    // Of the track being compared
+    size_t cards;
+};
+
+
+#endif /* MULTITRACK_HPP */
@@ -0,0 +1,326 @@
+/**
+    output.cpp
+
+    Machine-readable results, written by a thread of their own.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#include "output.hpp"
+#include "fileio.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#if defined( __WINDOWS_ASIO__ ) || defined( __WINDOWS_DS__ )
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+
+// Status of a record without any track
+#define STATUS_NONE 255
+
+
+// Format or data of a record without any track
+static const std::string no_text;
+
+bool
+parse_output_format(const char* name, OutputFormat& format)
+{
+    if(strcmp(name, "text") == 0)
+        format = OUTPUT_TEXT;
+    else if(strcmp(name, "json") == 0)
+        format = OUTPUT_JSON;
+    else if(strcmp(name, "binary") == 0)
+        format = OUTPUT_BINARY;
+    else
+        return false;
+
+    return true;
+}
+
+
+// Track a record describes: the first valid one, or the first one
+static const TrackResult*
+record_track(const SwipeResult& result)
+{
+    const TrackResult* track = result.match();
+
+    if(track == NULL && result.bits_found && ! result.tracks.empty())
+        track = &result.tracks[0];
+
+    return track;
+}
+
+// Name of a status in JSON
+static const char*
+status_name(const SwipeResult& result, const TrackResult* track)
+{
+    if(! result.bits_found)
+        return "no_bits";
+    if(track == NULL)
+        return "no_sentinel";
+
+    switch(track->status)
+    {
+        case PARSE_OK:
+            return "ok";
+        case PARSE_CHAR_PARITY:
+            return "parity";
+        case PARSE_LRC:
+            return "lrc";
+        default:
+            return "no_sentinel";
+    }
+}
+
+// String in JSON, quoted and escaped
+static void
+append_json_string(std::string& out, const std::string& text)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    out.push_back('"');
+
+    for(size_t i = 0; i < text.size(); i++)
+    {
+        unsigned char c = text[i];
+
+        if(c == '"' || c == '\\')
+        {
+            out.push_back('\\');
+            out.push_back(c);
+        }
+        else if(c < 0x20 || c >= 0x7F)
+        {
+            out.append("\\u00");
+            out.push_back(hex[c >> 4]);
+            out.push_back(hex[c & 0xF]);
+        }
+        else
+        {
+            out.push_back(c);
+        }
+    }
+
+    out.push_back('"');
+}
+
+// Unsigned integer in decimal
+static void
+append_number(std::string& out, uint64_t value)
+{
+    char digits[24];
+    size_t count = 0;
+
+    do
+    {
+        digits[count++] = (char) ('0' + value % 10);
+        value /= 10;
+    }
+    while(value != 0);
+
+    while(count > 0)
+    {
+        out.push_back(digits[--count]);
+    }
+}
+
+// Length (u16) and bytes of a string
+static void
+append_field(std::string& out, const std::string& text)
+{
+    size_t length = text.size() < 0xFFFF ? text.size() : 0xFFFF;
+
+    append_le(out, length, 2);
+    out.append(text, 0, length);
+}
+
+
+RecordWriter::RecordWriter(OutputFormat output_format, FILE* stream, bool live_input) :
+        format(output_format), out(stream), live(live_input), dropped_records(0),
+        stopping(false)
+{
+#if defined( __WINDOWS_ASIO__ ) || defined( __WINDOWS_DS__ )
+    // No translation of line ends in binary records
+    if(format == OUTPUT_BINARY)
+        _setmode(_fileno(out), _O_BINARY);
+#endif
+
+    pending.reserve(OUTPUT_BATCH);
+    thread = std::thread(&RecordWriter::run, this);
+}
+
+RecordWriter::~RecordWriter(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    wake.notify_one();
+    thread.join();
+
+    if(dropped_records > 0)
+    {
+        std::cerr << "Output could not keep up: " << dropped_records
+                  << " records dropped!" << std::endl;
+    }
+}
+
+size_t
+RecordWriter::dropped(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return dropped_records;
+}
+
+void
+RecordWriter::write(const std::string& source, unsigned int track,
+                    const SwipeResult& result, uint64_t latency)
+{
+    uint64_t time = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    bool first, full;
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        // A stalled output must not stall the decoders of live input;
+        // records of recordings are all written
+        if(live && pending.size() >= OUTPUT_LIMIT)
+        {
+            dropped_records++;
+            return;
+        }
+
+        room.wait(lock, [this]() { return pending.size() < OUTPUT_LIMIT; });
+
+        first = pending.empty();
+
+        if(format == OUTPUT_JSON)
+            append_json(source, track, result, time, latency);
+        else
+            append_binary(source, track, result, time, latency);
+
+        full = pending.size() >= OUTPUT_BATCH;
+    }
+
+    // Writer waits for the first record of a batch, and then for more
+    if(first || full)
+    {
+        wake.notify_one();
+    }
+}
+
+void
+RecordWriter::append_json(const std::string& source, unsigned int track,
+                          const SwipeResult& result, uint64_t time, uint64_t latency)
+{
+    const TrackResult* record = record_track(result);
+    std::string& json = pending;
+
+    json.append("{\"source\":");
+    append_json_string(json, source);
+    json.append(",\"track\":");
+    append_number(json, track);
+
+    // Seconds with microseconds
+    json.append(",\"time\":");
+    append_number(json, time / 1000000);
+    json.push_back('.');
+    for(uint64_t digit = 100000; digit > 0; digit /= 10)
+    {
+        json.push_back((char) ('0' + (time / digit) % 10));
+    }
+
+    json.append(",\"latency_us\":");
+    append_number(json, latency / 1000);
+    json.append(",\"bits\":");
+    append_number(json, result.bits_found ? result.bitstring.size() : 0);
+    json.append(",\"threshold\":");
+    if(result.silence_thres < 0)
+        json.push_back('-');
+    append_number(json, result.silence_thres < 0 ? -result.silence_thres : result.silence_thres);
+    json.append(result.recovered ? ",\"recovered\":true" : ",\"recovered\":false");
+
+    json.append(",\"format\":");
+    append_json_string(json, record != NULL ? record->parser : no_text);
+    json.append(record != NULL && record->reversed ? ",\"reversed\":true" : ",\"reversed\":false");
+    json.append(",\"status\":\"");
+    json.append(status_name(result, record));
+    json.append("\",\"data\":");
+    append_json_string(json, record != NULL ? record->data : no_text);
+    json.append("}\n");
+}
+
+void
+RecordWriter::append_binary(const std::string& source, unsigned int track,
+                            const SwipeResult& result, uint64_t time, uint64_t latency)
+{
+    const TrackResult* record = record_track(result);
+    std::string& binary = pending;
+
+    // Length is known at the end
+    const size_t start = binary.size();
+    append_le(binary, 0, 4);
+
+    unsigned int flags = (result.bits_found ? 1 : 0) |
+                         (record != NULL && record->reversed ? 2 : 0) |
+                         (result.recovered ? 4 : 0) |
+                         (result.match() != NULL ? 8 : 0);
+
+    append_le(binary, time, 8);
+    append_le(binary, latency / 1000, 4);
+    append_le(binary, result.bits_found ? result.bitstring.size() : 0, 4);
+    append_le(binary, (uint16_t) result.silence_thres, 2);
+    append_le(binary, track, 1);
+    append_le(binary, flags, 1);
+    append_le(binary, record != NULL ? (unsigned int) record->status : STATUS_NONE, 1);
+    append_field(binary, source);
+    append_field(binary, record != NULL ? record->parser : no_text);
+    append_field(binary, record != NULL ? record->data : no_text);
+
+    size_t length = binary.size() - start - 4;
+    for(unsigned int i = 0; i < 4; i++)
+    {
+        binary[start + i] = (char) ((length >> (8 * i)) & 0xFF);
+    }
+}
+
+void
+RecordWriter::run(void)
+{
+    std::string batch;
+    batch.reserve(OUTPUT_BATCH);
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while(true)
+    {
+        // Sleep until there is something to write
+        wake.wait(lock, [this]() { return stopping || ! pending.empty(); });
+
+        if(pending.empty())
+            break;
+
+        // Let a batch accumulate, but not for long
+        wake.wait_for(lock, std::chrono::milliseconds(OUTPUT_DELAY),
+                      [this]() { return stopping || pending.size() >= OUTPUT_BATCH; });
+
+        // Write without blocking the decoders
+        batch.swap(pending);
+        lock.unlock();
+        room.notify_all();
+
+        fwrite(batch.data(), 1, batch.size(), out);
+        fflush(out);
+        batch.clear();
+
+        lock.lock();
+    }
+}
@@ -0,0 +1,118 @@
+/**
+    output.hpp
+
+    Machine-readable results, written by a thread of their own.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#ifndef OUTPUT_HPP
+#define OUTPUT_HPP
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <inttypes.h>
+
+#include "decoder.hpp"
+
+
+// Bytes of records collected before the writer is woken up
+#define OUTPUT_BATCH (64 * 1024)
+
+// Longest time a record waits for the writer (in milliseconds)
+#define OUTPUT_DELAY 100
+
+// Bytes of records pending at most; further records of live input are
+// dropped, those of recordings wait for the writer
+#define OUTPUT_LIMIT (16 * 1024 * 1024)
+
+
+/**
+    Formats of the results.
+*/
+enum OutputFormat
+{
+    OUTPUT_TEXT,    // Human-readable, printed directly
+    OUTPUT_JSON,    // One JSON object per line
+    OUTPUT_BINARY   // Length-prefixed records
+};
+
+/**
+    Format of the given name (text, json or binary); false if unknown.
+*/
+bool parse_output_format(const char* name, OutputFormat& format);
+
+
+/**
+    Thread writing one record per swipe to a stream.
+
+    Records are appended to a pending buffer by the decoding threads,
+    which do not wait for I/O; the writer takes the buffer as a whole
+    and writes it in one go, once enough has accumulated or the oldest
+    record waited long enough. All records are written on destruction.
+    When OUTPUT_LIMIT bytes are pending, records of live input are
+    dropped, so that the audio input is not held up; otherwise, e.g.
+    for recordings, the decoders wait for room.
+
+    The record describes the first valid track, or else the first
+    candidate found. In JSON:
+
+        {"source":"0:1","track":0,"time":1300000000.000000,
+         "latency_us":61,"bits":251,"threshold":3689,"recovered":false,
+         "format":"ABA","reversed":false,"status":"ok","data":";123?"}
+
+    Status is one of ok, parity, lrc, no_sentinel or no_bits. Time is
+    in seconds since the epoch; track is 0 unless the channels of a
+    reader are its tracks, latency 0 if not measured.
+
+    A binary record consists of little endian fields: total length of
+    the rest (u32), time in microseconds (u64), latency in microseconds
+    (u32), bits (u32), threshold (i16), track (u8), flags (u8: 1 bits
+    found, 2 reversed, 4 recovered, 8 valid), status (u8, as
+    ParseStatus; 255 without any track), then source, format and data,
+    each as length (u16) and bytes.
+*/
+class RecordWriter
+{
+public:
+    RecordWriter(OutputFormat output_format, FILE* stream, bool live_input);
+    ~RecordWriter(void);
+
+    RecordWriter(const RecordWriter&) = delete;
+    RecordWriter& operator=(const RecordWriter&) = delete;
+
+    // Queue the record of a swipe; latency in nanoseconds
+    void write(const std::string& source, unsigned int track,
+               const SwipeResult& result, uint64_t latency);
+
+    // Records of live input that did not fit the pending buffer
+    size_t dropped(void);
+
+private:
+    void run(void);
+    void append_json(const std::string& source, unsigned int track,
+                     const SwipeResult& result, uint64_t time, uint64_t latency);
+    void append_binary(const std::string& source, unsigned int track,
+                       const SwipeResult& result, uint64_t time, uint64_t latency);
+
+    OutputFormat format;
+    FILE* out;
+    bool live;      // Drop records rather than wait for room
+
+    std::mutex mutex;
+    std::condition_variable wake;   // of the writer
+    std::condition_variable room;   // for records not to be dropped
+    std::string pending;    // Records not yet taken by the writer
+    size_t dropped_records;
+    bool stopping;
+    std::thread thread;
+};
+
+
+#endif /* OUTPUT_HPP */
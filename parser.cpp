@@ -0,0 +1,135 @@
+/**
+    parser.cpp
+
+    Parsers of magnetic stripe bit strings.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+
+    Based heavily upon dmsb.c by Joseph Battaglia.
+*/
+
+#include "parser.hpp"
+
+
+ParseStatus
+MagneticBitstringParser::parse(const BitView& bitstring, std::string& result)
+{
+    // Clear contents of the string
+    result.clear();
+
+    // Bits of a character without parity
+    const uint64_t data_mask = (1ULL << parity_bit) - 1;
+
+    // initial condition is LRC of the start sentinel
+    uint64_t lrc = start_sentinel;
+
+    // Find start of encoded string
+    size_t start_decode = bitstring.find(start_sentinel, char_length);
+
+    // If no start sentinel found, cancel processing
+    if(start_decode == BitView::npos)
+    {
+        return PARSE_NO_SENTINEL;
+    }
+
+    // Move start pointer to the next character past the start sentinel
+    start_decode += char_length;
+
+    // Find end of encoded string; ensure it's correct position
+    size_t end_decode = BitView::npos;
+    for(size_t i = start_decode + char_length;
+        i + char_length <= bitstring.size();
+        i += char_length)
+    {
+        if(bitstring.extract(i, char_length) == end_sentinel)
+        {
+            end_decode = i;
+            break;
+        }
+    }
+
+    // If no end sentinel found, cancel processing
+    if(end_decode == BitView::npos)
+    {
+        return PARSE_NO_SENTINEL;
+    }
+
+    // Enter start sentinel
+    result.push_back(decode_char(start_sentinel));
+
+    // Decoded character for character
+    for(size_t i = start_decode; i < end_decode + char_length; i += char_length)
+    {
+        // Extract bits
+        uint64_t char_bits = bitstring.extract(i, char_length);
+
+        if(! check_parity(char_bits))
+        {
+            // Parity mismatch
+            return PARSE_CHAR_PARITY;
+        }
+
+        // Decode bits
+        result.push_back(decode_char(char_bits));
+
+        // Update LRC
+        lrc ^= char_bits & data_mask;
+    }
+
+    // Check for correct LRC
+    if(! check_parity(lrc))
+    {
+        // Parity mismatch
+        return PARSE_LRC;
+    }
+
+    return PARSE_OK;
+}
+
+unsigned char
+MagneticBitstringParser::decode_char(uint64_t bits)
+{
+    return charset_begin + (bits & ((1ULL << parity_bit) - 1));
+}
+
+bool
+MagneticBitstringParser::check_parity(uint64_t bits)
+{
+    // Odd parity: number of set bits including the parity bit is odd
+    return bit_count(bits & ((1ULL << char_length) - 1)) % 2 == 1;
+}
+
+void
+account_number(const TrackResult& track, std::string& account)
+{
+    account.clear();
+
+    if(track.status != PARSE_OK)
+        return;
+
+    // Start sentinel, format code and field separator of the track
+    size_t start;
+    char separator;
+    if(track.parser == "IATA" && track.data.compare(0, 2, "%B") == 0)
+    {
+        start = 2;
+        separator = '^';
+    }
+    else if(track.parser == "ABA" && track.data.compare(0, 1, ";") == 0)
+    {
+        start = 1;
+        separator = '=';
+    }
+    else
+    {
+        return;
+    }
+
+    size_t end = track.data.find(separator, start);
+    if(end == std::string::npos)
+        return;
+
+    account.assign(track.data, start, end - start);
+}
@@ -0,0 +1,118 @@
+/**
+    parser.hpp
+
+    Parsers of magnetic stripe bit strings.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#ifndef PARSER_HPP
+#define PARSER_HPP
+
+#include <string>
+#include <vector>
+
+// For assertions
+#include <cassert>
+#include <cstring>
+
+#include "bitstring.hpp"
+
+
+/**
+    Outcome of parsing a bit string.
+*/
+enum ParseStatus
+{
+    PARSE_OK,               // Data between sentinels decoded and verified
+    PARSE_NO_SENTINEL,      // Start or end sentinel not found
+    PARSE_CHAR_PARITY,      // Character parity mismatch
+    PARSE_LRC               // Information parity mismatch
+};
+
+/**
+    Track decoded from a bit string by one of the parsers.
+*/
+struct TrackResult
+{
+    std::string parser;     // Name of the encoding
+    bool reversed;          // Decoded from the reversed bit string
+    ParseStatus status;     // Whether parity and LRC were correct
+    std::string data;       // Decoded characters
+};
+
+/**
+    Primary account number of a track decoded without errors: the
+    digits after the format code of IATA track 1 or after the start
+    sentinel of ABA track 2, up to the field separator. Empty if the
+    track has none.
+*/
+void account_number(const TrackResult& track, std::string& account);
+
+/**
+    Definition of the magnetic bitstring parser.
+
+    Parses a single encoding from the first start sentinel on; swipes
+    are decoded by EncodingRegistry, which tries all encodings in both
+    directions at once.
+*/
+class MagneticBitstringParser
+{
+public:
+    MagneticBitstringParser(void) : charset_begin('0') {  }
+    virtual ~MagneticBitstringParser(void) {  }
+    virtual ParseStatus parse(const BitView& bitstring, std::string& result);
+    void set_name(const char* parser_name) { name = parser_name; }
+    std::string get_name(void) { return name; }
+    void set_char_length(unsigned int length) { char_length = length; parity_bit = length - 1; }
+    void set_charset_begin(unsigned char first) { charset_begin = first; }
+    void set_start_sentinel(const char* sentinel) { assert(strlen(sentinel) == char_length); start_sentinel = bit_pattern(sentinel); }
+    void set_end_sentinel(const char* sentinel) { assert(strlen(sentinel) == char_length); end_sentinel = bit_pattern(sentinel); }
+    unsigned char decode_char(uint64_t bits);
+    bool check_parity(uint64_t bits);
+protected:
+    std::string name; // of the encoding
+    unsigned int char_length; // in bits
+    unsigned int parity_bit;
+    uint64_t start_sentinel;    // first bit lowest
+    uint64_t end_sentinel;
+    unsigned char charset_begin;    // character encoded by zero
+};
+
+/**
+    Definition of IATA parser.
+*/
+class IATAParser : public MagneticBitstringParser
+{
+public:
+    IATAParser(void)
+    {
+        set_name("IATA");
+        set_char_length(7);
+        set_charset_begin(' ');
+        set_start_sentinel("1010001");
+        set_end_sentinel("1111100");
+    }
+    virtual ~IATAParser(void) {  }
+};
+
+/**
+    Definition of ABA parser.
+*/
+class ABAParser : public MagneticBitstringParser
+{
+public:
+    ABAParser(void)
+    {
+        set_name("ABA");
+        set_char_length(5);
+        set_start_sentinel("11010");
+        set_end_sentinel("11111");
+    }
+    virtual ~ABAParser(void) {  }
+};
+
+
+#endif /* PARSER_HPP */
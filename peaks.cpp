@@ -0,0 +1,340 @@
+/**
+    peaks.cpp
+
+    Search for peaks in sample data.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#include "peaks.hpp"
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || ( defined( __i386__ ) && defined( __SSE2__ ) ) )
+#define PEAKS_X86
+#include <immintrin.h>
+#endif
+
+
+/**
+    Implementation of the two loops of the peak search.
+*/
+struct PeakKernel
+{
+    const char* name;
+
+    // First index at or after i with an absolute value above
+    // the threshold, or the input size
+    size_t (*skip_quiet)(const SampleSpan& input, size_t i, sample_t thres);
+
+    // First index at or after i with an absolute value not above
+    // the threshold, or the input size; loudest sample on the way
+    // (first one if several) is stored in peak and peak_index
+    size_t (*skip_loud)(const SampleSpan& input, size_t i, sample_t thres,
+                        sample_t& peak, size_t& peak_index);
+};
+
+
+static size_t
+skip_quiet_scalar(const SampleSpan& input, size_t i, sample_t thres)
+{
+    const size_t input_size = input.size();
+
+    for(; i < input_size && sample_abs(input[i]) <= thres; i++)
+    {
+    }
+
+    return i;
+}
+
+static size_t
+skip_loud_scalar(const SampleSpan& input, size_t i, sample_t thres,
+                 sample_t& peak, size_t& peak_index)
+{
+    const size_t input_size = input.size();
+
+    for(; i < input_size && sample_abs(input[i]) > thres; i++)
+    {
+        if(sample_abs(input[i]) > peak)
+        {
+            peak_index = i;
+            peak = sample_abs(input[i]);
+        }
+    }
+
+    return i;
+}
+
+static const PeakKernel scalar_kernel =
+{
+    "scalar", skip_quiet_scalar, skip_loud_scalar
+};
+
+
+#if defined( PEAKS_X86 )
+
+// Absolute values are max(x, 0 - x); like sample_abs(), -32768
+// stays negative. Comparisons are signed, as in the scalar loops.
+
+static size_t
+skip_quiet_sse2(const SampleSpan& input, size_t i, sample_t thres)
+{
+    const sample_t* data = input.contiguous();
+    if(data == NULL)
+        return skip_quiet_scalar(input, i, thres);
+
+    const size_t input_size = input.size();
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i threshold = _mm_set1_epi16(thres);
+
+    for(; i + 8 <= input_size; i += 8)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*) (data + i));
+        __m128i a = _mm_max_epi16(x, _mm_sub_epi16(zero, x));
+        unsigned int loud = _mm_movemask_epi8(_mm_cmpgt_epi16(a, threshold));
+
+        if(loud != 0)
+        {
+            return i + __builtin_ctz(loud) / 2;
+        }
+    }
+
+    return skip_quiet_scalar(input, i, thres);
+}
+
+static size_t
+skip_loud_sse2(const SampleSpan& input, size_t i, sample_t thres,
+               sample_t& peak, size_t& peak_index)
+{
+    const sample_t* data = input.contiguous();
+    if(data == NULL)
+        return skip_loud_scalar(input, i, thres, peak, peak_index);
+
+    const size_t input_size = input.size();
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i threshold = _mm_set1_epi16(thres);
+
+    for(; i + 8 <= input_size; i += 8)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*) (data + i));
+        __m128i a = _mm_max_epi16(x, _mm_sub_epi16(zero, x));
+        unsigned int quiet = ~_mm_movemask_epi8(_mm_cmpgt_epi16(a, threshold)) & 0xFFFF;
+        unsigned int louder = _mm_movemask_epi8(_mm_cmpgt_epi16(a, _mm_set1_epi16(peak)));
+
+        // Only blocks ending the run or raising the peak need a closer look
+        if((quiet | louder) != 0)
+        {
+            size_t end = quiet != 0 ? i + __builtin_ctz(quiet) / 2 : i + 8;
+
+            skip_loud_scalar(input.subspan(0, end), i, thres, peak, peak_index);
+
+            if(quiet != 0)
+                return end;
+        }
+    }
+
+    return skip_loud_scalar(input, i, thres, peak, peak_index);
+}
+
+static const PeakKernel sse2_kernel =
+{
+    "SSE2", skip_quiet_sse2, skip_loud_sse2
+};
+
+
+__attribute__(( target("avx2") ))
+static size_t
+skip_quiet_avx2(const SampleSpan& input, size_t i, sample_t thres)
+{
+    const sample_t* data = input.contiguous();
+    if(data == NULL)
+        return skip_quiet_scalar(input, i, thres);
+
+    const size_t input_size = input.size();
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i threshold = _mm256_set1_epi16(thres);
+
+    for(; i + 16 <= input_size; i += 16)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*) (data + i));
+        __m256i a = _mm256_max_epi16(x, _mm256_sub_epi16(zero, x));
+        unsigned int loud = _mm256_movemask_epi8(_mm256_cmpgt_epi16(a, threshold));
+
+        if(loud != 0)
+        {
+            return i + __builtin_ctz(loud) / 2;
+        }
+    }
+
+    return skip_quiet_scalar(input, i, thres);
+}
+
+__attribute__(( target("avx2") ))
+static size_t
+skip_loud_avx2(const SampleSpan& input, size_t i, sample_t thres,
+               sample_t& peak, size_t& peak_index)
+{
+    const sample_t* data = input.contiguous();
+    if(data == NULL)
+        return skip_loud_scalar(input, i, thres, peak, peak_index);
+
+    const size_t input_size = input.size();
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i threshold = _mm256_set1_epi16(thres);
+
+    for(; i + 16 <= input_size; i += 16)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*) (data + i));
+        __m256i a = _mm256_max_epi16(x, _mm256_sub_epi16(zero, x));
+        unsigned int quiet = ~_mm256_movemask_epi8(_mm256_cmpgt_epi16(a, threshold));
+        unsigned int louder = _mm256_movemask_epi8(_mm256_cmpgt_epi16(a, _mm256_set1_epi16(peak)));
+
+        // Only blocks ending the run or raising the peak need a closer look
+        if((quiet | louder) != 0)
+        {
+            size_t end = quiet != 0 ? i + __builtin_ctz(quiet) / 2 : i + 16;
+
+            skip_loud_scalar(input.subspan(0, end), i, thres, peak, peak_index);
+
+            if(quiet != 0)
+                return end;
+        }
+    }
+
+    return skip_loud_scalar(input, i, thres, peak, peak_index);
+}
+
+static const PeakKernel avx2_kernel =
+{
+    "AVX2", skip_quiet_avx2, skip_loud_avx2
+};
+
+#endif /* PEAKS_X86 */
+
+
+// Best implementation for this processor, chosen once
+static const PeakKernel&
+select_kernel(void)
+{
+#if defined( PEAKS_X86 )
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("avx2"))
+        return avx2_kernel;
+
+    if(__builtin_cpu_supports("sse2"))
+        return sse2_kernel;
+#endif
+
+    return scalar_kernel;
+}
+
+static const PeakKernel&
+get_kernel(void)
+{
+    static const PeakKernel& kernel = select_kernel();
+    return kernel;
+}
+
+
+void
+PeakTracker::reset(sample_t threshold)
+{
+    thres = threshold;
+    position = 0;
+    in_run = false;
+    peak = 0;
+    peak_index = 0;
+    old_peak_index = 0;
+}
+
+void
+PeakTracker::feed(const SampleSpan& block, std::vector<size_t>& intervals)
+{
+    const PeakKernel& kernel = get_kernel();
+    const size_t block_size = block.size();
+
+    for(size_t i = 0; i < block_size; )
+    {
+        // Search for the next peak
+        if(! in_run)
+        {
+            i = kernel.skip_quiet(block, i, thres);
+
+            // No more peaks in this block
+            if(i == block_size)
+            {
+                break;
+            }
+
+            in_run = true;
+            peak_index = position + i;
+            peak = sample_abs(block[i]);
+        }
+
+        // Follow the run; it may continue in the next block
+        size_t block_peak_index = peak_index - position;
+        i = kernel.skip_loud(block, i, thres, peak, block_peak_index);
+        peak_index = position + block_peak_index;
+
+        if(i < block_size)
+        {
+            end_run(intervals);
+        }
+    }
+
+    position += block_size;
+}
+
+void
+PeakTracker::finish(std::vector<size_t>& intervals)
+{
+    if(in_run)
+    {
+        end_run(intervals);
+    }
+}
+
+void
+PeakTracker::end_run(std::vector<size_t>& intervals)
+{
+    in_run = false;
+
+    size_t peak_index_diff = peak_index - old_peak_index;
+    if(peak_index_diff > 0)
+    {
+        intervals.push_back(peak_index_diff);
+    }
+
+    // Store peak index
+    old_peak_index = peak_index;
+}
+
+
+int
+peak_level(const SampleSegment& samples)
+{
+    int max = 0;
+    for(size_t i = 0; i < samples.part_count(); i++)
+    {
+        const SampleSpan& part = samples.part(i);
+        const size_t part_size = part.size();
+
+        for(size_t j = 0; j < part_size; j++)
+        {
+            int value = part[j] < 0 ? -part[j] : part[j];
+            if(value > max)
+            {
+                max = value;
+            }
+        }
+    }
+
+    return max;
+}
+
+const char*
+peak_kernel_name(void)
+{
+    return get_kernel().name;
+}
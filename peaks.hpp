@@ -0,0 +1,58 @@
+/**
+    peaks.hpp
+
+    Search for peaks in sample data.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#ifndef PEAKS_HPP
+#define PEAKS_HPP
+
+#include <vector>
+
+#include "samples.hpp"
+
+
+/**
+    Search for peaks in a stream of sample blocks.
+
+    Each peak is the loudest sample of a run of absolute values above
+    the threshold; the interval since the previous peak is known once
+    the run ends. Feeding all samples at once gives the same intervals
+    as feeding them block by block. Runs on SSE2 or AVX2 if the
+    processor has it; the input is never modified.
+*/
+class PeakTracker
+{
+public:
+    PeakTracker(void) { reset(0); }
+
+    // Start over with the given threshold
+    void reset(sample_t threshold);
+    // Append intervals of peaks completed within the block
+    void feed(const SampleSpan& block, std::vector<size_t>& intervals);
+    // End of input; completes a peak still in progress
+    void finish(std::vector<size_t>& intervals);
+
+private:
+    void end_run(std::vector<size_t>& intervals);
+
+    sample_t thres;
+    size_t position;        // Index of the first sample of the next block
+    bool in_run;            // Whether the last sample was above threshold
+    sample_t peak;          // Loudest value of the current run
+    size_t peak_index;
+    size_t old_peak_index;
+};
+
+// Largest absolute value of the samples; -32768 counts as 32768
+int peak_level(const SampleSegment& samples);
+
+// Name of the peak search implementation in use
+const char* peak_kernel_name(void);
+
+
+#endif /* PEAKS_HPP */
@@ -0,0 +1,134 @@
+/**
+    pushdecoder.cpp
+
+    Decoder of live input pushed by the embedding program.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#include "pushdecoder.hpp"
+
+#include <algorithm>
+
+
+std::string
+PushConfig::check(void) const
+{
+    if(sample_rate == 0)
+        return "No sample rate";
+
+    if(decimation < 1 || decimation > MAX_DECIMATION)
+        return "Invalid decimation factor";
+
+    if(sample_rate < decimation)
+        return "Sample rate too low for the decimation factor";
+
+    if(silence_thres <= 0)
+        return "Invalid silence threshold";
+
+    if(auto_thres < 0 || auto_thres > 100)
+        return "Invalid auto threshold";
+
+    if(capacity == 0)
+        return "No input buffer";
+
+    return "";
+}
+
+
+PushDecoder::PushDecoder(const PushConfig& push_config, const Callback& swipe_callback) :
+        config(push_config), error(push_config.check()), callback(swipe_callback),
+        decimator(error.empty() ? push_config.decimation : 1), stored(true),
+        ring(error.empty() ? push_config.capacity : 1)
+{
+    // Nothing to decode; pushed samples are dropped
+    if(! error.empty())
+        return;
+
+    if(config.recover)
+    {
+        recovery.reset(new ThreadPool(config.jobs));
+    }
+
+    thread = std::thread(&PushDecoder::decode, this);
+}
+
+PushDecoder::~PushDecoder(void)
+{
+    finish();
+}
+
+bool
+PushDecoder::push(const sample_t* samples, size_t count)
+{
+    const unsigned int factor = decimator.get_factor();
+    stored = true;
+
+    if(! error.empty())
+        return false;
+
+    if(factor == 1)
+    {
+        store(samples, count);
+        return stored;
+    }
+
+    // Reduce the sample rate first, on the stack, a part at a time
+    for(size_t offset = 0; offset < count; offset += DECIMATE_CHUNK * factor)
+    {
+        sample_t decimated[DECIMATE_CHUNK];
+        size_t length = std::min(count - offset, (size_t) DECIMATE_CHUNK * factor);
+        size_t decimated_count = decimator.process(samples + offset, length, decimated);
+
+        store(decimated, decimated_count);
+    }
+
+    return stored;
+}
+
+void
+PushDecoder::store(const sample_t* samples, size_t count)
+{
+    // Statistics are complete before the samples become visible
+    stats.update(samples, count);
+
+    if(! ring.write(samples, count))
+    {
+        stored = false;
+    }
+}
+
+void
+PushDecoder::finish(void)
+{
+    ring.close();
+
+    if(thread.joinable())
+    {
+        thread.join();
+    }
+}
+
+void
+PushDecoder::decode(void)
+{
+    SwipeDecoder decoder(config.silence_thres, config.auto_thres);
+    decoder.set_streaming(config.streaming);
+    if(config.realtime)
+        decoder.set_stats(&stats);
+    decoder.set_encodings(config.encodings);
+    decoder.set_recovery(recovery.get());
+
+    const unsigned int sample_rate = config.sample_rate / decimator.get_factor();
+
+    // Reused by every swipe
+    SwipeResult result;
+
+    while(decoder.find_swipe(ring, sample_rate))
+    {
+        decoder.decode_swipe(ring, result);
+        callback(result);
+    }
+}
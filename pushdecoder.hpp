@@ -0,0 +1,124 @@
+/**
+    pushdecoder.hpp
+
+    Decoder of live input pushed by the embedding program.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#ifndef PUSHDECODER_HPP
+#define PUSHDECODER_HPP
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "decimator.hpp"
+#include "decoder.hpp"
+#include "encodings.hpp"
+#include "samples.hpp"
+#include "signalstats.hpp"
+#include "threadpool.hpp"
+
+
+/**
+    Settings of a push decoder.
+*/
+struct PushConfig
+{
+    PushConfig(void) :
+        sample_rate(0), decimation(1), silence_thres(SILENCE_THRES),
+        auto_thres(AUTO_THRES), realtime(true), streaming(true), recover(false), jobs(0),
+        capacity(RING_BUFFER_SIZE), encodings(EncodingRegistry::standard()) {  }
+
+    unsigned int sample_rate;   // Of the pushed samples; has to be set
+    unsigned int decimation;    // Factor to reduce the sample rate by, up to
+                                // MAX_DECIMATION = 1
+    sample_t silence_thres;     //  = SILENCE_THRES
+    int auto_thres;             // Percent of the maximum; 0 if fixed = AUTO_THRES
+    bool realtime;              // Samples are pushed as they arrive, so levels
+                                // are measured meanwhile = true
+    bool streaming;             // Report swipes while in progress = true
+    bool recover;               // Re-decode failed swipes = false
+    unsigned int jobs;          // Threads re-decoding; 0 = all cores
+    size_t capacity;            // Of the input buffer (in samples)
+    EncodingRegistry encodings; // Standard encodings by default
+
+    // Why the settings cannot be used; empty if they can
+    std::string check(void) const;
+};
+
+
+/**
+    Decoder of a single reader fed by the embedding program, e.g. from
+    its own audio callback.
+
+    Samples are pushed into a ring buffer without blocking or
+    allocating; a thread of the decoder detects and decodes swipes and
+    hands every one of them to the callback, on that thread. Samples
+    pushed faster than real time, e.g. of a recording, need realtime
+    off; levels of a swipe are then taken from its samples. The
+    decoder keeps no global state and does neither exit nor print, so
+    any number of them may run in one process, for as long as it runs.
+
+    A decoder with invalid settings has an error and does not run;
+    samples pushed to it are dropped.
+*/
+class PushDecoder
+{
+public:
+    // Called for every swipe, also without bits or a valid track
+    typedef std::function<void(const SwipeResult& result)> Callback;
+
+    PushDecoder(const PushConfig& config, const Callback& swipe_callback);
+    ~PushDecoder(void);
+
+    PushDecoder(const PushDecoder&) = delete;
+    PushDecoder& operator=(const PushDecoder&) = delete;
+
+    /**
+        Add samples; called by one thread at a time. Returns false if
+        some were dropped because the decoder lags behind.
+    */
+    bool push(const sample_t* samples, size_t count);
+
+    /**
+        End of input: decode what is left, and return once the last
+        callback returned. Samples pushed afterwards are dropped.
+    */
+    void finish(void);
+
+    // Settings were invalid; the decoder does not run
+    const std::string& get_error(void) const { return error; }
+
+    // Samples dropped so far
+    size_t dropped(void) const { return ring.dropped(); }
+    // Levels of the input, e.g. for a meter
+    SignalStats& get_stats(void) { return stats; }
+
+private:
+    void store(const sample_t* samples, size_t count);
+    void decode(void);
+
+    const PushConfig config;
+    const std::string error;
+    Callback callback;
+
+    // Producer side
+    Decimator decimator;
+    bool stored;    // All samples of the current push were stored
+
+    // Shared
+    SampleRing ring;
+    SignalStats stats;
+
+    // Decoder side
+    std::unique_ptr<ThreadPool> recovery;
+    std::thread thread;
+};
+
+
+#endif /* PUSHDECODER_HPP */
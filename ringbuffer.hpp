@@ -0,0 +1,223 @@
+/**
+    ringbuffer.hpp
+
+    Bounded lock-free single-producer/single-consumer ring buffer.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#ifndef RINGBUFFER_HPP
+#define RINGBUFFER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <condition_variable>
+
+// For assertions
+#include <cassert>
+
+
+// Size of a cache line (in bytes); indices are padded to it
+#define CACHE_LINE_SIZE 64
+
+
+/**
+    Ring buffer with a single producer (audio callback) and
+    a single consumer (main thread).
+
+    Positions are absolute and grow monotonically; the producer publishes
+    the write position with release semantics after the samples were stored,
+    the consumer publishes the read position with release semantics after
+    it does not need the samples before it anymore. Storage is allocated
+    once in the constructor, so writing never allocates.
+
+    The consumer may block in wait() until enough samples arrived; the
+    producer takes the lock to wake it only while somebody is waiting.
+    The consumer publishes that it waits before it checks the position
+    again, the producer publishes the position (or the end of input)
+    before it checks whether somebody waits; full fences between these
+    steps on both sides ensure that at least one of them sees the
+    other, so a wakeup is never missed.
+*/
+template<typename T>
+class RingBuffer
+{
+public:
+    RingBuffer(size_t min_capacity) :
+        write_index(0), read_index(0), waiting(false), closed(false),
+        dropped_frames(0)
+    {
+        // Round capacity up to the next power of two
+        for(capacity_ = 1; capacity_ < min_capacity; capacity_ *= 2)
+        {
+        }
+
+        mask = capacity_ - 1;
+        data = new T[capacity_];
+    }
+    ~RingBuffer(void) { delete[] data; }
+
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    /**
+        Store samples; called by the producer only. If there is not
+        enough room, the part that fits is stored and the rest dropped,
+        so that the buffer fills up completely whatever the size of
+        the blocks. Returns false if samples were dropped.
+    */
+    bool write(const T* src, size_t count)
+    {
+        const size_t w = write_index.load(std::memory_order_relaxed);
+        const size_t r = read_index.load(std::memory_order_acquire);
+        const size_t room = capacity_ - (w - r);
+        const bool complete = room >= count;
+
+        if(! complete)
+        {
+            dropped_frames.fetch_add(count - room, std::memory_order_relaxed);
+            count = room;
+
+            if(count == 0)
+                return false;
+        }
+
+        // Copy up to the end of storage, then wrap around
+        size_t offset = w & mask;
+        size_t first_part = count < capacity_ - offset ? count : capacity_ - offset;
+
+        for(size_t i = 0; i < first_part; i++)
+        {
+            data[offset + i] = src[i];
+        }
+
+        for(size_t i = first_part; i < count; i++)
+        {
+            data[i - first_part] = src[i];
+        }
+
+        write_index.store(w + count, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        notify();
+
+        return complete;
+    }
+
+    /**
+        Mark end of input (e.g. aborted stream) and wake up the consumer.
+    */
+    void close(void)
+    {
+        closed.store(true, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        notify();
+    }
+
+    /**
+        Block until samples before the given position are available;
+        called by the consumer. Returns false if the buffer was closed
+        before that happened.
+    */
+    bool wait(size_t position)
+    {
+        if(size() >= position)
+            return true;
+
+        std::unique_lock<std::mutex> lock(wait_mutex);
+        waiting.store(true, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        while(write_index.load(std::memory_order_seq_cst) < position &&
+              ! closed.load(std::memory_order_seq_cst))
+        {
+            wait_condition.wait(lock);
+        }
+
+        waiting.store(false, std::memory_order_relaxed);
+
+        return size() >= position;
+    }
+
+    // Position past the last written sample; called by the consumer
+    size_t size(void) const { return write_index.load(std::memory_order_acquire); }
+
+    // Position of the first sample still kept; called by the consumer
+    size_t begin(void) const { return read_index.load(std::memory_order_relaxed); }
+
+    // Sample at absolute position; must lie in [begin(), size())
+    const T& at(size_t index) const
+    {
+        assert(index >= begin() && index < size());
+        return data[index & mask];
+    }
+
+    /**
+        Elements of [start, end) in place: pointer to the first one and
+        in count the number stored contiguously after it, up to the end
+        of storage. The rest, if any, starts at position start + count.
+    */
+    const T* contiguous(size_t start, size_t end, size_t& count) const
+    {
+        assert(start >= begin() && start <= end && end <= size());
+
+        size_t offset = start & mask;
+        count = end - start < capacity_ - offset ? end - start : capacity_ - offset;
+
+        return data + offset;
+    }
+
+    // Hand storage before the given position back to the producer
+    void release(size_t index)
+    {
+        assert(index >= begin() && index <= size());
+        read_index.store(index, std::memory_order_release);
+    }
+
+    bool is_closed(void) const { return closed.load(std::memory_order_acquire); }
+    size_t capacity(void) const { return capacity_; }
+    size_t dropped(void) const { return dropped_frames.load(std::memory_order_relaxed); }
+
+private:
+    // Read-only after construction
+    T* data;
+    size_t capacity_;
+    size_t mask;
+    char pad0[CACHE_LINE_SIZE];
+
+    // Written by the producer
+    std::atomic<size_t> write_index;
+    char pad1[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+
+    // Written by the consumer
+    std::atomic<size_t> read_index;
+    char pad2[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+
+    // Wake up the consumer if it is blocked in wait()
+    void notify(void)
+    {
+        if(waiting.load(std::memory_order_seq_cst))
+        {
+            // Taking the lock ensures the consumer is either before its
+            // check of the position or already waiting on the condition
+            { std::lock_guard<std::mutex> lock(wait_mutex); }
+            wait_condition.notify_one();
+        }
+    }
+
+    // Wakeup of the consumer
+    std::mutex wait_mutex;
+    std::condition_variable wait_condition;
+    std::atomic<bool> waiting;
+    std::atomic<bool> closed;
+
+    // Statistics, written by the producer
+    std::atomic<size_t> dropped_frames;
+};
+
+
+#endif /* RINGBUFFER_HPP */
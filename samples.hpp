@@ -0,0 +1,110 @@
+/**
+    samples.hpp
+
+    Sample type and non-owning views of sample data.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#ifndef SAMPLES_HPP
+#define SAMPLES_HPP
+
+#include <cstddef>
+
+#include <inttypes.h>
+
+// For assertions
+#include <cassert>
+
+
+// We use signed 16 bit value as a sample
+typedef int16_t sample_t;
+
+
+/**
+    Absolute value of a sample.
+
+    As the original in-place conversion did, -32768 wraps around
+    to itself and is therefore never louder than any threshold.
+*/
+inline sample_t
+sample_abs(sample_t sample)
+{
+    return sample < 0 ? (sample_t) -sample : sample;
+}
+
+
+/**
+    Read-only view of samples owned by someone else,
+    e.g. a memory-mapped file. Interleaved data is accessed
+    with a stride of the channel count.
+*/
+class SampleSpan
+{
+public:
+    SampleSpan(void) : data(NULL), length(0), stride(1) {  }
+    SampleSpan(const sample_t* samples, size_t count, size_t step = 1) :
+        data(samples), length(count), stride(step) {  }
+
+    size_t size(void) const { return length; }
+    bool empty(void) const { return length == 0; }
+    sample_t operator[](size_t index) const { return data[index * stride]; }
+
+    // Samples as a plain array, or NULL if they are interleaved
+    const sample_t* contiguous(void) const { return stride == 1 ? data : NULL; }
+
+    // View of [start, end) of this view
+    SampleSpan subspan(size_t start, size_t end) const
+    {
+        return SampleSpan(data + start * stride, end - start, stride);
+    }
+
+private:
+    const sample_t* data;
+    size_t length;
+    size_t stride;
+};
+
+
+/**
+    Samples of a segment of input in at most two parts, e.g. a swipe
+    wrapping around the end of a ring buffer. Nothing is copied.
+*/
+class SampleSegment
+{
+public:
+    SampleSegment(void) : count(0) {  }
+    SampleSegment(const SampleSpan& span) : count(0) { append(span); }
+
+    void append(const SampleSpan& span)
+    {
+        assert(count < 2);
+
+        if(! span.empty())
+        {
+            parts[count++] = span;
+        }
+    }
+
+    size_t part_count(void) const { return count; }
+    const SampleSpan& part(size_t index) const { return parts[index]; }
+
+    size_t size(void) const
+    {
+        size_t length = 0;
+        for(size_t i = 0; i < count; i++)
+        {
+            length += parts[i].size();
+        }
+        return length;
+    }
+
+private:
+    SampleSpan parts[2];
+    size_t count;
+};
+
+
+#endif /* SAMPLES_HPP */
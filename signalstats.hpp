@@ -0,0 +1,198 @@
+/**
+    signalstats.hpp
+
+    Running statistics of the input signal.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#ifndef SIGNALSTATS_HPP
+#define SIGNALSTATS_HPP
+
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstddef>
+
+#include <inttypes.h>
+
+#include "samples.hpp"
+
+
+// Weight of the newest quiet block in the noise floor (1 / blocks)
+#define NOISE_FLOOR_BLOCKS 64
+
+// Level of clipped samples
+#define CLIP_LEVEL 32767
+
+
+/**
+    Levels of all samples so far, read at once. Counters only grow (and
+    wrap around), so the levels between two snapshots are given by the
+    differences of their counters.
+*/
+struct LevelSnapshot
+{
+    uint64_t samples;   // Accounted so far
+    uint64_t squares;   // Sum of the squared levels
+    uint64_t clipped;   // Samples at CLIP_LEVEL or beyond
+    int max_peak;       // Largest level so far
+};
+
+
+/**
+    Statistics updated by the producer with every block of samples
+    and read by the consumer at any time.
+
+    Every value is a single atomic, so neither side ever waits. Levels
+    are absolute values; -32768 counts as 32768. The noise floor is an
+    exponential moving average of the RMS of quiet blocks, i.e. blocks
+    without any sample above the quiet level set by the consumer.
+
+    Levels for a meter are published as a snapshot under a sequence
+    lock: the producer makes the sequence odd while it writes them, and
+    a reader retries until it saw the same even sequence before and
+    after reading. The peak of the meter is taken by swapping it with
+    zero, so that no block is missed between two readings.
+*/
+class SignalStats
+{
+public:
+    SignalStats(void) :
+        peak_level(0), block_rms(0), noise_level(0), meter_peak(0), sequence(0),
+        total_samples(0), total_squares(0), total_clipped(0), max_level(0),
+        quiet_level(INT_MAX), noise(0.0), noise_valid(false) {  }
+
+    SignalStats(const SignalStats&) = delete;
+    SignalStats& operator=(const SignalStats&) = delete;
+
+    /**
+        Account a block of samples; called by the producer only.
+    */
+    void update(const sample_t* block, size_t count)
+    {
+        if(count == 0)
+            return;
+
+        int block_peak = 0;
+        uint64_t squares = 0;
+        uint64_t clipped = 0;
+        for(size_t i = 0; i < count; i++)
+        {
+            int value = block[i] < 0 ? -block[i] : block[i];
+
+            if(value > block_peak)
+            {
+                block_peak = value;
+            }
+
+            squares += (uint64_t) (value * value);
+            clipped += value >= CLIP_LEVEL;
+        }
+
+        double rms = std::sqrt((double) squares / count);
+        block_rms.store((int) rms, std::memory_order_relaxed);
+
+        // Raise the peaks, unless the consumers reset them meanwhile
+        raise(peak_level, block_peak);
+        raise(meter_peak, block_peak);
+
+        // Publish the levels of the meter
+        const uint32_t next = sequence.load(std::memory_order_relaxed) + 1;
+        sequence.store(next, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        total_samples.store(total_samples.load(std::memory_order_relaxed) + count,
+                            std::memory_order_relaxed);
+        total_squares.store(total_squares.load(std::memory_order_relaxed) + squares,
+                            std::memory_order_relaxed);
+        total_clipped.store(total_clipped.load(std::memory_order_relaxed) + clipped,
+                            std::memory_order_relaxed);
+        if(block_peak > max_level.load(std::memory_order_relaxed))
+            max_level.store(block_peak, std::memory_order_relaxed);
+
+        sequence.store(next + 1, std::memory_order_release);
+
+        // Follow the noise floor in quiet blocks only; the first
+        // block gives the initial estimate
+        if(! noise_valid || block_peak <= quiet_level.load(std::memory_order_relaxed))
+        {
+            noise = noise_valid ? noise + (rms - noise) / NOISE_FLOOR_BLOCKS : rms;
+            noise_valid = true;
+
+            noise_level.store((int) (noise + 0.5), std::memory_order_relaxed);
+        }
+    }
+
+    // Largest level since the last mark
+    int peak(void) const { return peak_level.load(std::memory_order_relaxed); }
+    // Start measuring the peak anew
+    void mark(void) { peak_level.store(0, std::memory_order_relaxed); }
+
+    // RMS of the last block
+    int rms(void) const { return block_rms.load(std::memory_order_relaxed); }
+    // Typical RMS of quiet input; 0 until the first block
+    int noise_floor(void) const { return noise_level.load(std::memory_order_relaxed); }
+    // Blocks with no level above this one are quiet
+    void set_quiet_level(int level) { quiet_level.store(level, std::memory_order_relaxed); }
+
+    // Largest level since the last call; for a single meter only
+    int take_meter_peak(void) { return meter_peak.exchange(0, std::memory_order_relaxed); }
+
+    /**
+        Read the levels of the meter at once; waits only while the
+        producer updates them, i.e. for a few stores.
+    */
+    void levels(LevelSnapshot& snapshot) const
+    {
+        while(true)
+        {
+            const uint32_t before = sequence.load(std::memory_order_acquire);
+
+            snapshot.samples = total_samples.load(std::memory_order_relaxed);
+            snapshot.squares = total_squares.load(std::memory_order_relaxed);
+            snapshot.clipped = total_clipped.load(std::memory_order_relaxed);
+            snapshot.max_peak = max_level.load(std::memory_order_relaxed);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if(before % 2 == 0 && sequence.load(std::memory_order_relaxed) == before)
+                return;
+        }
+    }
+
+private:
+    static void raise(std::atomic<int>& level, int value)
+    {
+        int current = level.load(std::memory_order_relaxed);
+        while(value > current &&
+              ! level.compare_exchange_weak(current, value, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    // Published to the consumer
+    std::atomic<int> peak_level;
+    std::atomic<int> block_rms;
+    std::atomic<int> noise_level;
+    std::atomic<int> meter_peak;
+
+    // Published to the meter under the sequence lock
+    std::atomic<uint32_t> sequence;
+    std::atomic<uint64_t> total_samples;
+    std::atomic<uint64_t> total_squares;
+    std::atomic<uint64_t> total_clipped;
+    std::atomic<int> max_level;
+
+    // Set by the consumer
+    std::atomic<int> quiet_level;
+
+    // Producer only
+    double noise;
+    bool noise_valid;
+};
+
+
+#endif /* SIGNALSTATS_HPP */
@@ -0,0 +1,106 @@
+/**
+    soundfile.cpp
+
+    Memory-mapped recordings (WAV or raw signed 16 bit little endian).
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#include "soundfile.hpp"
+
+#include <cstring>
+
+
+SoundFile::SoundFile(void) :
+        sample_rate(0), read_index(0)
+{
+}
+
+SoundFile::~SoundFile(void)
+{
+    close();
+}
+
+bool
+SoundFile::open(const char* file_name, unsigned int raw_sample_rate)
+{
+    close();
+    error.clear();
+
+    if(! file.open(file_name))
+        return fail(file.get_error());
+
+    const unsigned char* file_data = file.data();
+
+    // WAV file
+    if(file.size() >= 12 &&
+       memcmp(file_data, "RIFF", 4) == 0 &&
+       memcmp(file_data + 8, "WAVE", 4) == 0)
+    {
+        return parse_wav(file_data, file.size());
+    }
+
+    // Raw mono signed 16 bit little endian samples
+    sample_rate = raw_sample_rate;
+    samples = SampleSpan((const sample_t*) file_data, file.size() / sizeof(sample_t));
+
+    return true;
+}
+
+bool
+SoundFile::parse_wav(const unsigned char* file_data, size_t file_size)
+{
+    unsigned int channels = 0;
+    unsigned int bits_per_sample = 0;
+
+    // Walk through the chunks after the RIFF header
+    for(size_t pos = 12; pos + 8 <= file_size; )
+    {
+        const unsigned char* chunk = file_data + pos;
+        size_t chunk_size = read_le(chunk + 4, 4);
+        size_t body = pos + 8;
+
+        if(memcmp(chunk, "fmt ", 4) == 0 && chunk_size >= 16 && body + 16 <= file_size)
+        {
+            unsigned int format = read_le(file_data + body, 2);
+
+            // PCM, or WAVE_FORMAT_EXTENSIBLE
+            if(format != 1 && format != 0xFFFE)
+                return fail("Only PCM WAV files are supported");
+
+            channels = read_le(file_data + body + 2, 2);
+            sample_rate = read_le(file_data + body + 4, 4);
+            bits_per_sample = read_le(file_data + body + 14, 2);
+        }
+        else if(memcmp(chunk, "data", 4) == 0)
+        {
+            if(bits_per_sample != 16 || channels < 1)
+                return fail("Only 16 bit WAV files are supported");
+
+            // Streamed files may carry a bogus data size
+            if(chunk_size > file_size - body)
+                chunk_size = file_size - body;
+
+            samples = SampleSpan((const sample_t*) (file_data + body),
+                                 chunk_size / (channels * sizeof(sample_t)),
+                                 channels);
+
+            return true;
+        }
+
+        // Chunks are padded to even size
+        pos = body + chunk_size + (chunk_size & 1);
+    }
+
+    return fail("No audio data in WAV file");
+}
+
+void
+SoundFile::close(void)
+{
+    file.close();
+    samples = SampleSpan();
+    read_index = 0;
+}
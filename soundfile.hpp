@@ -0,0 +1,64 @@
+/**
+    soundfile.hpp
+
+    Memory-mapped recordings (WAV or raw signed 16 bit little endian).
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#ifndef SOUNDFILE_HPP
+#define SOUNDFILE_HPP
+
+#include <string>
+
+// For assertions
+#include <cassert>
+
+#include "fileio.hpp"
+#include "samples.hpp"
+
+
+/**
+    Recording mapped into memory. Samples are read in place; of
+    multi-channel files the first channel is used.
+
+    Offers the same consumer interface as the input ring buffer,
+    as if all samples had already been written and the input closed.
+*/
+class SoundFile
+{
+public:
+    SoundFile(void);
+    ~SoundFile(void);
+
+    bool open(const char* file_name, unsigned int raw_sample_rate);
+    void close(void);
+    const std::string& get_error(void) const { return error; }
+    unsigned int get_sample_rate(void) const { return sample_rate; }
+
+    // Consumer interface
+    size_t size(void) const { return samples.size(); }
+    size_t begin(void) const { return read_index; }
+    sample_t at(size_t index) const { assert(index < size()); return samples[index]; }
+    bool wait(size_t position) { return position <= size(); }
+    void release(size_t index) { read_index = index; }
+    bool is_closed(void) const { return true; }
+
+    // Samples of [start, end) without copying them
+    SampleSpan span(size_t start, size_t end) const { return samples.subspan(start, end); }
+
+private:
+    bool parse_wav(const unsigned char* file_data, size_t file_size);
+    bool fail(const std::string& message) { error = message; close(); return false; }
+
+    MappedFile file;
+    SampleSpan samples;
+    unsigned int sample_rate;
+    size_t read_index;
+    std::string error;
+};
+
+
+#endif /* SOUNDFILE_HPP */
@@ -0,0 +1,102 @@
+/**
+    swipegen.cpp
+
+    Synthetic swipes, e.g. for benchmarks.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#include "swipegen.hpp"
+
+#include <inttypes.h>
+
+
+// Silence before and after the swipe (in milliseconds)
+#define SWIPE_MARGIN 250
+
+
+std::string
+encode_track(const std::string& data, unsigned int char_length,
+             unsigned char charset_begin)
+{
+    const unsigned int data_bits = char_length - 1;
+    std::string result;
+    unsigned int lrc = 0;
+
+    // Characters, then the LRC character
+    for(size_t i = 0; i <= data.size(); i++)
+    {
+        unsigned int value = i < data.size() ?
+            (unsigned char) data[i] - charset_begin : lrc;
+        unsigned int set_bits = 0;
+
+        for(unsigned int bit = 0; bit < data_bits; bit++)
+        {
+            bool set = (value >> bit) & 1;
+            result.push_back(set ? '1' : '0');
+            set_bits += set;
+        }
+
+        // Odd parity
+        result.push_back(set_bits % 2 == 0 ? '1' : '0');
+
+        lrc ^= value;
+    }
+
+    return result;
+}
+
+void
+encode_aiken_biphase(const std::string& bits, const SwipeParameters& params,
+                     std::vector<sample_t>& samples)
+{
+    const double swipe_time = STRIPE_LENGTH / params.swipe_speed;
+    const double swipe_time_bit = swipe_time / params.bit_density;
+    const size_t samples_zero = (size_t) (params.sample_rate * swipe_time_bit);
+    const size_t samples_one = samples_zero / 2;
+    const size_t margin = (size_t) params.sample_rate * SWIPE_MARGIN / 1000;
+
+    // Add margins to the bit sequence
+    const std::string stripe_margin(8, '0');
+    const std::string padded = stripe_margin + bits + stripe_margin;
+
+    // Magnetization of the stripe, starting with a zero
+    std::vector<bool> flux(samples_zero, false);
+    bool direction = true;
+    for(size_t i = 0; i < padded.size(); i++)
+    {
+        if(padded[i] == '1')
+        {
+            flux.insert(flux.end(), samples_one, direction);
+            flux.insert(flux.end(), samples_one, ! direction);
+        }
+        else
+        {
+            flux.insert(flux.end(), samples_zero, direction);
+            direction = ! direction;
+        }
+    }
+
+    // Head picks up changes of the flux
+    samples.assign(margin + flux.size() + margin, 0);
+
+    for(size_t i = 1; i < flux.size(); i++)
+    {
+        if(flux[i] != flux[i - 1])
+        {
+            samples[margin + i] = flux[i] ? params.amplitude : -params.amplitude;
+        }
+    }
+
+    // Add reproducible noise everywhere
+    uint32_t random = 1;
+    for(size_t i = 0; params.noise > 0 && i < samples.size(); i++)
+    {
+        random = random * 1103515245 + 12345;
+
+        int value = samples[i] + (int) ((random >> 16) % (2 * params.noise + 1)) - params.noise;
+        samples[i] = (sample_t) (value > 32767 ? 32767 : value < -32768 ? -32768 : value);
+    }
+}
@@ -0,0 +1,54 @@
+/**
+    swipegen.hpp
+
+    Synthetic swipes, e.g. for benchmarks.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#ifndef SWIPEGEN_HPP
+#define SWIPEGEN_HPP
+
+#include <string>
+#include <vector>
+
+#include "samples.hpp"
+
+
+// Length of a standard magnetic stripe (in millimeters)
+#define STRIPE_LENGTH 85.73
+
+
+/**
+    Parameters of a synthetic swipe.
+*/
+struct SwipeParameters
+{
+    double swipe_speed;         // In mm/s
+    unsigned int bit_density;   // Bits per track
+    unsigned int sample_rate;   // In Hz
+    sample_t amplitude;         // Height of the peaks
+    sample_t noise;             // Largest deviation of the noise
+};
+
+/**
+    Encode characters of a track as in encode_track of mcu.ml: every
+    character first bit lowest, followed by odd parity, and the LRC
+    character at the end. The result consists of '0' and '1'.
+*/
+std::string encode_track(const std::string& data, unsigned int char_length,
+                         unsigned char charset_begin);
+
+/**
+    Samples of a swipe of the given bits, as in encode_aiken_biphase
+    of mcu.ml. The flux reversals of the stripe become peaks, as the
+    read head delivers them; silence before and after is long enough
+    for the end of the swipe to be detected.
+*/
+void encode_aiken_biphase(const std::string& bits, const SwipeParameters& params,
+                          std::vector<sample_t>& samples);
+
+
+#endif /* SWIPEGEN_HPP */
@@ -0,0 +1,187 @@
+/**
+    threadpool.cpp
+
+    Work-stealing thread pool.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#include "threadpool.hpp"
+
+// Platform-dependent thread affinity
+#if defined( __WINDOWS_ASIO__ ) || defined( __WINDOWS_DS__ )
+  #include <windows.h>
+#elif defined( __linux__ )
+  #include <pthread.h>
+  #include <sched.h>
+#endif
+
+
+bool
+pin_thread(unsigned int cpu)
+{
+#if defined( __WINDOWS_ASIO__ ) || defined( __WINDOWS_DS__ )
+    if(cpu >= sizeof(DWORD_PTR) * 8)
+        return false;
+
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR) 1 << cpu) != 0;
+#elif defined( __linux__ )
+    if(cpu >= CPU_SETSIZE)
+        return false;
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+#else
+    (void) cpu;
+    return false;
+#endif
+}
+
+
+ThreadPool::ThreadPool(unsigned int threads) :
+        next_queue(0), queued(0), unfinished(0), stopping(false)
+{
+    // Use all cores by default
+    if(threads == 0)
+    {
+        threads = std::thread::hardware_concurrency();
+    }
+
+    if(threads == 0)
+    {
+        threads = 1;
+    }
+
+    for(unsigned int i = 0; i < threads; i++)
+    {
+        queues.push_back(std::unique_ptr<Queue>(new Queue));
+    }
+
+    for(unsigned int i = 0; i < threads; i++)
+    {
+        workers.push_back(std::thread(&ThreadPool::work, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        stopping = true;
+    }
+
+    work_available.notify_all();
+
+    for(size_t i = 0; i < workers.size(); i++)
+    {
+        workers[i].join();
+    }
+}
+
+void
+ThreadPool::submit(const Task& task)
+{
+    unsigned int index = next_queue.fetch_add(1) % queues.size();
+
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(task);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        queued++;
+        unfinished++;
+    }
+
+    work_available.notify_one();
+}
+
+void
+ThreadPool::wait(void)
+{
+    std::unique_lock<std::mutex> lock(state_mutex);
+
+    while(unfinished > 0)
+    {
+        work_done.wait(lock);
+    }
+}
+
+bool
+ThreadPool::pop(unsigned int worker, Task& task)
+{
+    // Own queue first, oldest task
+    {
+        Queue& own = *queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+
+        if(! own.tasks.empty())
+        {
+            task = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+
+    // Steal the oldest task of another worker
+    for(size_t i = 1; i < queues.size(); i++)
+    {
+        Queue& victim = *queues[(worker + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+
+        if(! victim.tasks.empty())
+        {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void
+ThreadPool::work(unsigned int worker)
+{
+    while(true)
+    {
+        // Sleep until there is something to do
+        {
+            std::unique_lock<std::mutex> lock(state_mutex);
+
+            while(queued == 0 && ! stopping)
+            {
+                work_available.wait(lock);
+            }
+
+            if(queued == 0 && stopping)
+            {
+                return;
+            }
+
+            queued--;
+        }
+
+        // A task is reserved for us; it is in one of the queues
+        Task task;
+        while(! pop(worker, task))
+        {
+            std::this_thread::yield();
+        }
+
+        task(worker);
+
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            unfinished--;
+        }
+
+        work_done.notify_all();
+    }
+}
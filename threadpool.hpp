@@ -0,0 +1,82 @@
+/**
+    threadpool.hpp
+
+    Work-stealing thread pool.
+
+    Part of Magnetic stripe Card Utility.
+
+    Copyright (c) 2010-2011 Wincent Balin
+*/
+
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/**
+    Bind the calling thread to a CPU (numbered from 0); false if that
+    fails or is not supported on the platform.
+*/
+bool pin_thread(unsigned int cpu);
+
+
+/**
+    Pool of worker threads, each with its own task queue.
+
+    A worker takes its own oldest task first and, when its queue is
+    empty, steals the oldest task of another worker, so tasks start
+    in about the order they were submitted. Tasks get the
+    number of the worker running them, so that per-worker state can be
+    kept by the caller without locking.
+*/
+class ThreadPool
+{
+public:
+    typedef std::function<void(unsigned int worker)> Task;
+
+    ThreadPool(unsigned int threads = 0);
+    ~ThreadPool(void);
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned int size(void) const { return (unsigned int) workers.size(); }
+
+    // Queue a task; tasks are spread over the workers
+    void submit(const Task& task);
+    // Block until all queued tasks finished
+    void wait(void);
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void work(unsigned int worker);
+    bool pop(unsigned int worker, Task& task);
+
+    std::vector<std::unique_ptr<Queue> > queues;
+    std::vector<std::thread> workers;
+    std::atomic<unsigned int> next_queue;
+
+    // Sleeping while idle, and waiting for completion
+    std::mutex state_mutex;
+    std::condition_variable work_available;
+    std::condition_variable work_done;
+    size_t queued;      // Tasks not yet taken by a worker
+    size_t unfinished;  // Tasks not yet completed
+    bool stopping;
+};
+
+
+#endif /* THREADPOOL_HPP */